@@ -1,12 +1,77 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <unistd.h>
-#include <sys/mman.h> 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
 
 #include <errno.h>
 
-#define NUM_BLOCKS 50
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "allocation.h"
+#include "fs_stats.h"
+
+/* The number of blocks of a new disk, unless set_disk_size() is
+ * called or an existing table file says otherwise.
+ */
+#define DEFAULT_NUM_BLOCKS 50
+
+/* In memory, the table is a bitmap with one bit per block. Bit b is
+ * bit b%64 of word b/64, and a set bit means that the block is used.
+ * The unused bits at the end of the last word are always set so that
+ * a search never finds them.
+ */
+#define BITS_PER_WORD 64
+#define FULL_WORD     (~(uint64_t)0)
+
+/* The free space index summarizes the bitmap on two more levels: the
+ * number of unused blocks in every group of 64 words (4096 blocks),
+ * and in every super group of 64 groups (262144 blocks). A search
+ * skips groups and super groups without unused blocks, or without
+ * used blocks, by looking at a single counter.
+ */
+#define WORDS_PER_GROUP   64
+#define GROUPS_PER_SUPER  64
+#define BLOCKS_PER_GROUP  ( WORDS_PER_GROUP * BITS_PER_WORD )
+#define BLOCKS_PER_SUPER  ( GROUPS_PER_SUPER * BLOCKS_PER_GROUP )
+#define WORDS_PER_SUPER   ( GROUPS_PER_SUPER * WORDS_PER_GROUP )
+
+/* Table files in BAT_FORMAT_BITMAP start with this header. The words
+ * of the bitmap follow it in little-endian byte order. Files without
+ * the header are in the old byte per block format, and the number of
+ * blocks is the file size.
+ */
+#define BAT_MAGIC "BAT1"
+
+struct bat_header
+{
+    char     magic[4];
+    uint32_t format;
+    uint64_t num_blocks;
+};
+
+struct bat
+{
+    int       num_blocks;
+    int       num_words;
+    uint64_t* words;
+
+    int       num_groups;
+    int       num_supers;
+    uint16_t* group_free;
+    uint32_t* super_free;
+};
+
+/* The default number of modified blocks that may be kept in the
+ * cached table before it is written back automatically.
+ */
+#define DEFAULT_FLUSH_THRESHOLD 64
 
 /* The name of the file that contains our block allocation table
  * that simulates the used disk.
@@ -14,88 +79,1135 @@
  */
 static char* file_name = NULL;
 
-void set_block_allocation_table_name( char* str )
+/* The layout in which the table is written to file, BAT_FORMAT_BYTES
+ * or BAT_FORMAT_BITMAP. Opening an existing file sets it to the
+ * format of that file.
+ */
+static int table_format = BAT_FORMAT_BYTES;
+
+/* The number of blocks of the disk. Opening or reading an existing
+ * file sets it to the size stored in that file, format_disk() uses
+ * it for the new table.
+ */
+static int disk_size = DEFAULT_NUM_BLOCKS;
+
+/* The size chosen with set_disk_size(), or -1. It takes precedence
+ * over disk_size when format_disk() creates a new table.
+ */
+static int requested_size = -1;
+
+/* In BAT_MODE_CACHED, the table is read from file once and kept in
+ * cached_table. dirty_count counts the blocks that were changed since
+ * the table was last written back.
+ */
+static int         table_mode      = BAT_MODE_SYNCHRONOUS;
+static struct bat* cached_table    = NULL;
+static int         dirty_count     = 0;
+static int         flush_threshold = DEFAULT_FLUSH_THRESHOLD;
+
+/* In BAT_MODE_MMAP, the whole table file is mapped at map_addr and
+ * mapped_table.words points to the bitmap behind the header.
+ */
+static void*       map_addr        = NULL;
+static size_t      map_length      = 0;
+static struct bat  mapped_table;
+
+/* In BAT_MODE_CONCURRENT, cached_table is shared by all threads.
+ * Blocks are claimed and released with atomic operations on the words
+ * of the bitmap and on the counters of the free space index, and
+ * dirty_count is updated atomically. Each thread starts its search at
+ * its own word_hint, so that threads do not compete for the same
+ * words. The table is only written by flush_shared_table(), which
+ * flush_mutex serializes, and normally from the flusher thread.
+ * table_lock guards the first load of the table and the flusher
+ * thread's state.
+ */
+static __thread int    word_hint       = -1;
+static unsigned int    next_thread     = 0;
+static pthread_mutex_t table_lock      = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t flush_mutex     = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  flusher_wake    = PTHREAD_COND_INITIALIZER;
+static pthread_t       flusher_thread;
+static int             flusher_running = 0;
+static int             flusher_stop    = 0;
+static int             flush_requested = 0;
+
+static int  map_table( );
+static void unmap_table( );
+static void start_flusher( );
+static void stop_flusher( );
+static void request_flush( );
+static int  flush_shared_table( );
+
+static void free_index( struct bat* table )
+{
+    free( table->group_free );
+    free( table->super_free );
+    table->group_free = NULL;
+    table->super_free = NULL;
+}
+
+static void free_table( struct bat* table )
+{
+    if( table )
+    {
+        free_index( table );
+        free( table->words );
+        free( table );
+    }
+}
+
+/* Look at the beginning of the file name to find out its format and
+ * number of blocks. Files without a header are taken to be in
+ * format_hint. Returns 0 in case of success and -1 if the file
+ * cannot be read.
+ */
+static int probe_table_file( const char* name, int format_hint,
+                             int* format, int* num_blocks, long* payload_offset )
+{
+    FILE* f = fopen( name, "r" );
+    if( !f )
+    {
+        return -1;
+    }
+    FS_STATS_COUNT( FS_COUNT_BAT_OPENS, 1 );
+
+    struct bat_header header;
+    size_t num = fread( &header, 1, sizeof(header), f );
+    FS_STATS_COUNT( FS_COUNT_BAT_READS, 1 );
+    FS_STATS_COUNT( FS_COUNT_BAT_BYTES_READ, num );
+    fseek( f, 0, SEEK_END );
+    long size = ftell( f );
+    fclose( f );
+
+    if( num == sizeof(header) && memcmp( header.magic, BAT_MAGIC, 4 ) == 0 )
+    {
+        *format         = header.format;
+        *num_blocks     = header.num_blocks;
+        *payload_offset = sizeof(header);
+    }
+    else
+    {
+        *format         = format_hint;
+        *num_blocks     = ( format_hint == BAT_FORMAT_BITMAP ) ? size * 8 : size;
+        *payload_offset = 0;
+    }
+    return 0;
+}
+
+void set_block_allocation_table_name( char* str )
+{
+    if( file_name != NULL )
+    {
+        fprintf( stderr, "Cannot set %s as block allocation table name.\n"
+                         "The name of the block_allocation_table has already been set to %s\n",
+                         str, file_name );
+        exit( -1 );
+    }
+
+    file_name = strdup( str );
+
+    int  format;
+    int  num_blocks;
+    long offset;
+    if( probe_table_file( file_name, BAT_FORMAT_BYTES, &format, &num_blocks, &offset ) == 0 )
+    {
+        table_format = format;
+        disk_size    = num_blocks;
+
+        if( table_mode == BAT_MODE_MMAP )
+        {
+            map_table( );
+        }
+    }
+}
+
+void release_block_allocation_table_name( )
+{
+    stop_flusher( );
+    flush_block_allocation_table( );
+
+    free_table( cached_table );
+    cached_table = NULL;
+
+    unmap_table( );
+
+    if( file_name )
+    {
+        free( file_name );
+        file_name = NULL;
+    }
+}
+
+static inline int test_bit( const uint64_t* table, int block )
+{
+    return ( table[block / BITS_PER_WORD] >> ( block % BITS_PER_WORD ) ) & 1;
+}
+
+static inline void set_bit( uint64_t* table, int block )
+{
+    table[block / BITS_PER_WORD] |= (uint64_t)1 << ( block % BITS_PER_WORD );
+}
+
+static inline void clear_bit( uint64_t* table, int block )
+{
+    table[block / BITS_PER_WORD] &= ~( (uint64_t)1 << ( block % BITS_PER_WORD ) );
+}
+
+/* Mark the bits behind the last block as used.
+ */
+static void set_padding_bits( struct bat* table )
+{
+    for( int b=table->num_blocks; b<table->num_words*BITS_PER_WORD; b++ )
+    {
+        set_bit( table->words, b );
+    }
+}
+
+/* Count the unused blocks of every group and super group. This is
+ * done whenever a table is read, created, mapped or resized.
+ * Returns 0 in case of success and -1 if memory runs out.
+ */
+static int build_index( struct bat* table )
+{
+    free_index( table );
+
+    table->num_groups = ( table->num_words + WORDS_PER_GROUP - 1 ) / WORDS_PER_GROUP;
+    table->num_supers = ( table->num_groups + GROUPS_PER_SUPER - 1 ) / GROUPS_PER_SUPER;
+    table->group_free = calloc( table->num_groups ? table->num_groups : 1, sizeof(uint16_t) );
+    table->super_free = calloc( table->num_supers ? table->num_supers : 1, sizeof(uint32_t) );
+    if( table->group_free == NULL || table->super_free == NULL )
+    {
+        fprintf( stderr, "Failed to allocate the free space index\n" );
+        free_index( table );
+        return -1;
+    }
+
+    for( int w=0; w<table->num_words; w++ )
+    {
+        int unused = BITS_PER_WORD - __builtin_popcountll( table->words[w] );
+        table->group_free[w / WORDS_PER_GROUP] += unused;
+        table->super_free[w / WORDS_PER_SUPER] += unused;
+    }
+    return 0;
+}
+
+/* The number of real blocks, not counting padding, in group g and
+ * in super group sg.
+ */
+static int group_blocks( const struct bat* table, int g )
+{
+    int left = table->num_blocks - g * BLOCKS_PER_GROUP;
+    return ( left < BLOCKS_PER_GROUP ) ? left : BLOCKS_PER_GROUP;
+}
+
+static int super_blocks( const struct bat* table, int sg )
+{
+    int left = table->num_blocks - sg * BLOCKS_PER_SUPER;
+    return ( left < BLOCKS_PER_SUPER ) ? left : BLOCKS_PER_SUPER;
+}
+
+/* Change the state of a block and keep the index up to date.
+ */
+static void mark_used( struct bat* table, int block )
+{
+    set_bit( table->words, block );
+    table->group_free[block / BLOCKS_PER_GROUP] -= 1;
+    table->super_free[block / BLOCKS_PER_SUPER] -= 1;
+}
+
+static void mark_unused( struct bat* table, int block )
+{
+    clear_bit( table->words, block );
+    table->group_free[block / BLOCKS_PER_GROUP] += 1;
+    table->super_free[block / BLOCKS_PER_SUPER] += 1;
+}
+
+/* Allocate an empty bitmap for num_blocks blocks, all blocks unused.
+ */
+static struct bat* new_table( int num_blocks )
+{
+    struct bat* table = malloc( sizeof(struct bat) );
+    if( table == NULL )
+    {
+        fprintf( stderr, "Failed to allocate %d bytes\n", (int)sizeof(struct bat) );
+        return NULL;
+    }
+
+    table->num_blocks = num_blocks;
+    table->num_words  = ( num_blocks + BITS_PER_WORD - 1 ) / BITS_PER_WORD;
+    table->group_free = NULL;
+    table->super_free = NULL;
+    table->words      = calloc( table->num_words ? table->num_words : 1, sizeof(uint64_t) );
+    if( table->words == NULL )
+    {
+        fprintf( stderr, "Failed to allocate %d bytes\n", (int)(table->num_words * sizeof(uint64_t)) );
+        free( table );
+        return NULL;
+    }
+    set_padding_bits( table );
+    if( build_index( table ) != 0 )
+    {
+        free_table( table );
+        return NULL;
+    }
+    return table;
+}
+
+/* Return the index of the first word in [start,end) that has at
+ * least one unused block, or end if there is none.
+ * Fully used regions are skipped several words at a time when the
+ * compiler offers SIMD instructions.
+ */
+static int skip_full_words( const struct bat* table, int start, int end )
+{
+    const uint64_t* words     = table->words;
+    int             num_words = end;
+    int             w         = start;
+
+#if defined(__AVX2__)
+    const __m256i ones = _mm256_set1_epi64x( -1 );
+    for( ; w + 4 <= num_words; w += 4 )
+    {
+        __m256i v = _mm256_loadu_si256( (const __m256i*)&words[w] );
+        if( !_mm256_testc_si256( v, ones ) ) break;
+    }
+#elif defined(__SSE2__)
+    const __m128i ones = _mm_set1_epi32( -1 );
+    for( ; w + 2 <= num_words; w += 2 )
+    {
+        __m128i v = _mm_loadu_si128( (const __m128i*)&words[w] );
+        if( _mm_movemask_epi8( _mm_cmpeq_epi32( v, ones ) ) != 0xffff ) break;
+    }
+#endif
+
+    for( ; w < num_words; w++ )
+    {
+        if( words[w] != FULL_WORD ) break;
+    }
+    return w;
+}
+
+/* Return the number of the first unused block at or after from,
+ * or -1 if there is none.
+ * Groups and super groups without unused blocks are skipped with
+ * the free space index, so that a nearly full disk is not scanned
+ * word by word.
+ */
+static int find_next_free( const struct bat* table, int from )
+{
+    if( from >= table->num_blocks )
+    {
+        return -1;
+    }
+
+    int      w      = from / BITS_PER_WORD;
+    uint64_t unused = ~table->words[w] & ( FULL_WORD << ( from % BITS_PER_WORD ) );
+    if( unused != 0 )
+    {
+        return w * BITS_PER_WORD + __builtin_ctzll( unused );
+    }
+
+    w += 1;
+    while( w < table->num_words )
+    {
+        int g = w / WORDS_PER_GROUP;
+        if( w % WORDS_PER_SUPER == 0 && table->super_free[w / WORDS_PER_SUPER] == 0 )
+        {
+            w += WORDS_PER_SUPER;
+            continue;
+        }
+        if( w % WORDS_PER_GROUP == 0 && table->group_free[g] == 0 )
+        {
+            w += WORDS_PER_GROUP;
+            continue;
+        }
+
+        int end = ( g + 1 ) * WORDS_PER_GROUP;
+        if( end > table->num_words ) end = table->num_words;
+
+        w = skip_full_words( table, w, end );
+        if( w < end )
+        {
+            return w * BITS_PER_WORD + __builtin_ctzll( ~table->words[w] );
+        }
+    }
+    return -1;
+}
+
+/* Return the number of the first used block at or after from, or
+ * table->num_blocks if all blocks from there to the end are unused.
+ * Groups and super groups without used blocks are skipped with the
+ * free space index.
+ */
+static int find_next_used( const struct bat* table, int from )
+{
+    if( from >= table->num_blocks )
+    {
+        return table->num_blocks;
+    }
+
+    int      w    = from / BITS_PER_WORD;
+    uint64_t used = table->words[w] & ( FULL_WORD << ( from % BITS_PER_WORD ) );
+
+    w += 1;
+    while( used == 0 && w < table->num_words )
+    {
+        int g = w / WORDS_PER_GROUP;
+        if( w % WORDS_PER_SUPER == 0 &&
+            (int)table->super_free[w / WORDS_PER_SUPER] == super_blocks( table, w / WORDS_PER_SUPER ) )
+        {
+            w += WORDS_PER_SUPER;
+            continue;
+        }
+        if( w % WORDS_PER_GROUP == 0 && table->group_free[g] == group_blocks( table, g ) )
+        {
+            w += WORDS_PER_GROUP;
+            continue;
+        }
+
+        used = table->words[w];
+        w += 1;
+    }
+
+    if( used == 0 )
+    {
+        return table->num_blocks;
+    }
+
+    int block = ( w - 1 ) * BITS_PER_WORD + __builtin_ctzll( used );
+    return ( block < table->num_blocks ) ? block : table->num_blocks;
+}
+
+/* Return the number of the first unused block, or -1 if the
+ * disk is full.
+ */
+static int find_free_block( const struct bat* table )
+{
+    return find_next_free( table, 0 );
+}
+
+/* Decode size bytes of table file content in the given format into
+ * the bitmap. Any non-zero byte in the byte format counts as used.
+ */
+static void decode_table( const unsigned char* raw, long size, int format, struct bat* table )
+{
+    if( format == BAT_FORMAT_BITMAP )
+    {
+        for( int w=0; w<table->num_words; w++ )
+        {
+            uint64_t word = 0;
+            for( int k=0; k<8 && w*8+k<size; k++ )
+            {
+                word |= (uint64_t)raw[w*8+k] << ( 8*k );
+            }
+            table->words[w] = word;
+        }
+        set_padding_bits( table );
+    }
+    else
+    {
+        for( int b=0; b<table->num_blocks; b++ )
+        {
+            if( raw[b] != 0 ) set_bit( table->words, b );
+        }
+    }
+}
+
+static long table_payload_size( const struct bat* table, int format )
+{
+    if( format == BAT_FORMAT_BITMAP )
+    {
+        return (long)table->num_words * sizeof(uint64_t);
+    }
+    return table->num_blocks;
+}
+
+/* Encode the bitmap into the file format. raw must have room
+ * for table_payload_size() bytes.
+ */
+static void encode_table( const struct bat* table, int format, unsigned char* raw )
+{
+    if( format == BAT_FORMAT_BITMAP )
+    {
+        for( int w=0; w<table->num_words; w++ )
+        {
+            for( int k=0; k<8; k++ )
+            {
+                raw[w*8+k] = table->words[w] >> ( 8*k );
+            }
+        }
+    }
+    else
+    {
+        for( int b=0; b<table->num_blocks; b++ )
+        {
+            raw[b] = test_bit( table->words, b );
+        }
+    }
+}
+
+static struct bat* load_table_file( const char* name, int format_hint )
+{
+    int  format;
+    int  num_blocks;
+    long offset;
+    if( probe_table_file( name, format_hint, &format, &num_blocks, &offset ) != 0 )
+    {
+        fprintf( stderr, "Failed to open file %s for reading\n", name );
+        perror("reason:");
+        return NULL;
+    }
+
+    struct bat* table = new_table( num_blocks );
+    if( table == NULL )
+    {
+        return NULL;
+    }
+
+    long size = ( format == BAT_FORMAT_BITMAP && offset == 0 )
+              ? ( num_blocks + 7 ) / 8
+              : table_payload_size( table, format );
+
+    unsigned char* raw = malloc( size ? size : 1 );
+    if( raw == NULL )
+    {
+        fprintf( stderr, "Failed to allocate %ld bytes\n", size );
+        free_table( table );
+        return NULL;
+    }
+
+    FILE* f = fopen( name, "r" );
+    if( !f )
+    {
+        fprintf( stderr, "Failed to open file %s for reading\n", name );
+        perror("reason:");
+        free( raw );
+        free_table( table );
+        return NULL;
+    }
+    FS_STATS_COUNT( FS_COUNT_BAT_OPENS, 1 );
+
+    fseek( f, offset, SEEK_SET );
+    long num_read = fread( raw, 1, size, f );
+    FS_STATS_COUNT( FS_COUNT_BAT_READS, 1 );
+    FS_STATS_COUNT( FS_COUNT_BAT_BYTES_READ, num_read );
+    if( num_read != size )
+    {
+        fprintf( stderr, "Failed to load %d block entries from disk\n", num_blocks );
+        perror("reason:");
+        fclose(f);
+        free( raw );
+        free_table( table );
+        return NULL;
+    }
+    fclose( f );
+
+    decode_table( raw, size, format, table );
+    free( raw );
+
+    if( build_index( table ) != 0 )
+    {
+        free_table( table );
+        return NULL;
+    }
+
+    return table;
+}
+
+static int store_table_file( const char* name, int format, const struct bat* table )
+{
+    long size = table_payload_size( table, format );
+
+    unsigned char* raw = malloc( size ? size : 1 );
+    if( raw == NULL )
+    {
+        fprintf( stderr, "Failed to allocate %ld bytes\n", size );
+        return -1;
+    }
+    encode_table( table, format, raw );
+
+    FILE* f = fopen( name, "w" );
+    if( !f )
+    {
+        fprintf( stderr, "Failed to open file %s for writing\n", name );
+        perror("reason:");
+        free( raw );
+        return -1;
+    }
+    FS_STATS_COUNT( FS_COUNT_BAT_OPENS, 1 );
+
+    if( format == BAT_FORMAT_BITMAP )
+    {
+        struct bat_header header;
+        memcpy( header.magic, BAT_MAGIC, 4 );
+        header.format     = format;
+        header.num_blocks = table->num_blocks;
+        fwrite( &header, 1, sizeof(header), f );
+        FS_STATS_COUNT( FS_COUNT_BAT_BYTES_WRITTEN, sizeof(header) );
+    }
+
+    long num = fwrite( raw, 1, size, f );
+    FS_STATS_COUNT( FS_COUNT_BAT_WRITES, 1 );
+    FS_STATS_COUNT( FS_COUNT_BAT_BYTES_WRITTEN, num );
+    free( raw );
+    if( num != size )
+    {
+        fprintf( stderr, "Failed to write %ld bytes to %s\n", size, name);
+        fprintf( stderr, "fwrite returned %ld\n", num );
+        perror("reason:");
+        fclose( f );
+        return -1;
+    }
+    fclose( f );
+    return 0;
+}
+
+static struct bat* read_table( )
+{
+    if( file_name == NULL )
+    {
+        fprintf( stderr, "Failed to set the name of the block allocation table file.\n" );
+        exit( -1 );
+    }
+
+    struct bat* table = load_table_file( file_name, BAT_FORMAT_BYTES );
+    if( table )
+    {
+        disk_size = table->num_blocks;
+    }
+    return table;
+}
+
+static int write_table( const struct bat* table )
+{
+    if( file_name == NULL )
+    {
+        fprintf( stderr, "Failed to set the name of the block allocation table file.\n" );
+        exit( -1 );
+    }
+
+    return store_table_file( file_name, table_format, table );
+}
+
+/* Map the table file into memory for BAT_MODE_MMAP. A table in the
+ * byte per block format is converted to the bitmap format first,
+ * because only the bitmap can be used in place.
+ * Returns 0 in case of success and -1 otherwise.
+ */
+static int map_table( )
+{
+    if( file_name == NULL )
+    {
+        fprintf( stderr, "Failed to set the name of the block allocation table file.\n" );
+        exit( -1 );
+    }
+
+    int  format;
+    int  num_blocks;
+    long offset;
+    if( probe_table_file( file_name, BAT_FORMAT_BYTES, &format, &num_blocks, &offset ) != 0 )
+    {
+        fprintf( stderr, "Failed to open file %s for reading\n", file_name );
+        perror("reason:");
+        return -1;
+    }
+
+    if( format != BAT_FORMAT_BITMAP )
+    {
+        struct bat* table = load_table_file( file_name, format );
+        if( table == NULL )
+        {
+            return -1;
+        }
+        int retval = store_table_file( file_name, BAT_FORMAT_BITMAP, table );
+        free_table( table );
+        if( retval != 0 )
+        {
+            return -1;
+        }
+    }
+    table_format = BAT_FORMAT_BITMAP;
+
+    int fd = open( file_name, O_RDWR );
+    if( fd < 0 )
+    {
+        fprintf( stderr, "Failed to open file %s for writing\n", file_name );
+        perror("reason:");
+        return -1;
+    }
+    FS_STATS_COUNT( FS_COUNT_BAT_OPENS, 1 );
+
+    struct stat st;
+    int num_words = ( num_blocks + BITS_PER_WORD - 1 ) / BITS_PER_WORD;
+    if( fstat( fd, &st ) != 0 ||
+        (size_t)st.st_size < sizeof(struct bat_header) + num_words * sizeof(uint64_t) )
+    {
+        fprintf( stderr, "The block allocation table %s is too short for %d blocks\n", file_name, num_blocks );
+        close( fd );
+        return -1;
+    }
+
+    void* addr = mmap( NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+    close( fd );
+    if( addr == MAP_FAILED )
+    {
+        fprintf( stderr, "Failed to map file %s\n", file_name );
+        perror("reason:");
+        return -1;
+    }
+
+    map_addr                = addr;
+    map_length              = st.st_size;
+    mapped_table.num_blocks = num_blocks;
+    mapped_table.num_words  = num_words;
+    mapped_table.words      = (uint64_t*)( (char*)addr + sizeof(struct bat_header) );
+    set_padding_bits( &mapped_table );
+    if( build_index( &mapped_table ) != 0 )
+    {
+        munmap( map_addr, map_length );
+        map_addr = NULL;
+        return -1;
+    }
+
+    disk_size   = num_blocks;
+    dirty_count = 0;
+    return 0;
+}
+
+/* Write back and remove the mapping of BAT_MODE_MMAP, if any.
+ */
+static void unmap_table( )
+{
+    if( map_addr == NULL )
+    {
+        return;
+    }
+
+    flush_block_allocation_table( );
+    munmap( map_addr, map_length );
+    map_addr           = NULL;
+    map_length         = 0;
+    mapped_table.words = NULL;
+    free_index( &mapped_table );
+}
+
+void set_block_allocation_table_mode( int mode )
+{
+    if( mode != BAT_MODE_SYNCHRONOUS && mode != BAT_MODE_CACHED && mode != BAT_MODE_MMAP &&
+        mode != BAT_MODE_CONCURRENT )
+    {
+        fprintf( stderr, "Unknown block allocation table mode %d\n", mode );
+        return;
+    }
+
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+    if( mode == BAT_MODE_MMAP )
+    {
+        fprintf( stderr, "BAT_MODE_MMAP needs a little-endian host, using BAT_MODE_CACHED\n" );
+        mode = BAT_MODE_CACHED;
+    }
+#endif
+
+    if( mode == table_mode )
+    {
+        return;
+    }
+
+    stop_flusher( );
+    if( cached_table )
+    {
+        flush_block_allocation_table( );
+        free_table( cached_table );
+        cached_table = NULL;
+    }
+    unmap_table( );
+
+    table_mode = mode;
+
+    if( mode == BAT_MODE_MMAP && file_name != NULL && access( file_name, F_OK ) == 0 )
+    {
+        map_table( );
+    }
+}
+
+void set_block_allocation_table_format( int format )
+{
+    if( format != BAT_FORMAT_BYTES && format != BAT_FORMAT_BITMAP )
+    {
+        fprintf( stderr, "Unknown block allocation table format %d\n", format );
+        return;
+    }
+
+    if( table_mode == BAT_MODE_MMAP && format != BAT_FORMAT_BITMAP )
+    {
+        fprintf( stderr, "BAT_MODE_MMAP only works with BAT_FORMAT_BITMAP\n" );
+        return;
+    }
+
+    /* The table is written in the new format from now on. A cached
+     * table is converted at the next write-back.
+     */
+    table_format = format;
+    if( cached_table )
+    {
+        dirty_count += 1;
+    }
+}
+
+void set_block_allocation_table_flush_threshold( int dirty_blocks )
+{
+    flush_threshold = dirty_blocks;
+}
+
+int flush_block_allocation_table( )
+{
+    if( table_mode == BAT_MODE_CONCURRENT )
+    {
+        return flush_shared_table( );
+    }
+
+    if( dirty_count == 0 )
+    {
+        return 0;
+    }
+
+    if( map_addr != NULL )
+    {
+        if( msync( map_addr, map_length, MS_SYNC ) != 0 )
+        {
+            fprintf( stderr, "Failed to sync file %s\n", file_name );
+            perror("reason:");
+            return -1;
+        }
+        FS_STATS_COUNT( FS_COUNT_BAT_WRITES, 1 );
+        FS_STATS_COUNT( FS_COUNT_BAT_BYTES_WRITTEN, map_length );
+        dirty_count = 0;
+        return 0;
+    }
+
+    if( cached_table == NULL )
+    {
+        return 0;
+    }
+
+    if( write_table( cached_table ) != 0 )
+    {
+        return -1;
+    }
+
+    dirty_count = 0;
+    return 0;
+}
+
+int convert_block_allocation_table( char* src, int src_format, char* dst, int dst_format )
+{
+    struct bat* table = load_table_file( src, src_format );
+    if( table == NULL )
+    {
+        return -1;
+    }
+
+    int retval = store_table_file( dst, dst_format, table );
+    free_table( table );
+    return retval;
+}
+
+void set_disk_size( int num_blocks )
+{
+    if( num_blocks < 0 )
+    {
+        fprintf( stderr, "Disk size %d is not valid\n", num_blocks );
+        return;
+    }
+    disk_size      = num_blocks;
+    requested_size = num_blocks;
+}
+
+int get_disk_size( )
+{
+    return disk_size;
+}
+
+/* Return the table that allocate_block() and free_block() work on.
+ * In synchronous mode this is a fresh copy of the file, in cached
+ * mode it is the table that stays in memory, and in mmap mode it is
+ * the mapped file itself.
+ */
+static struct bat* get_table( )
+{
+    if( table_mode == BAT_MODE_SYNCHRONOUS )
+    {
+        return read_table( );
+    }
+
+    if( table_mode == BAT_MODE_MMAP )
+    {
+        if( map_addr == NULL && map_table( ) != 0 )
+        {
+            return NULL;
+        }
+        return &mapped_table;
+    }
+
+    if( table_mode == BAT_MODE_CONCURRENT )
+    {
+        struct bat* table = __atomic_load_n( &cached_table, __ATOMIC_ACQUIRE );
+        if( table == NULL )
+        {
+            pthread_mutex_lock( &table_lock );
+            if( cached_table == NULL )
+            {
+                dirty_count = 0;
+                __atomic_store_n( &cached_table, read_table( ), __ATOMIC_RELEASE );
+            }
+            table = cached_table;
+            pthread_mutex_unlock( &table_lock );
+            start_flusher( );
+        }
+        return table;
+    }
+
+    if( cached_table == NULL )
+    {
+        cached_table = read_table( );
+        dirty_count  = 0;
+    }
+    return cached_table;
+}
+
+/* Hand back a table obtained from get_table(). changed is the number
+ * of blocks that were modified. In synchronous mode the table is
+ * written immediately, in cached and mmap mode only when the number
+ * of dirty blocks reaches the flush threshold.
+ */
+static int put_table( struct bat* table, int changed )
 {
-    if( file_name != NULL )
+    int retval = 0;
+
+    if( table_mode == BAT_MODE_SYNCHRONOUS )
     {
-        fprintf( stderr, "Cannot set %s as block allocation table name.\n"
-                         "The name of the block_allocation_table has already been set to %s\n",
-                         str, file_name );
-        exit( -1 );
+        if( changed > 0 )
+        {
+            retval = write_table( table );
+        }
+        free_table( table );
+        return retval;
     }
 
-    file_name = strdup( str );
+    if( table_mode == BAT_MODE_CONCURRENT )
+    {
+        if( changed > 0 )
+        {
+            int dirty = __atomic_add_fetch( &dirty_count, changed, __ATOMIC_RELAXED );
+            if( flush_threshold > 0 && dirty >= flush_threshold && dirty - changed < flush_threshold )
+            {
+                request_flush( );
+            }
+        }
+        return 0;
+    }
+
+    dirty_count += changed;
+    if( flush_threshold > 0 && dirty_count >= flush_threshold )
+    {
+        retval = flush_block_allocation_table( );
+    }
+    return retval;
 }
 
-void release_block_allocation_table_name( )
+/* Claim an unused block of the shared table for BAT_MODE_CONCURRENT,
+ * starting at the word hint of the calling thread. A new thread gets
+ * a hint spread over the table by a multiplicative hash of its number.
+ * A block that another thread frees during the search may be missed.
+ * Returns the block, or -1 if no unused block was found.
+ */
+static int claim_block( struct bat* table )
 {
-    if( file_name )
+    if( table->num_words == 0 )
     {
-        free( file_name );
+        return -1;
+    }
+    if( word_hint < 0 || word_hint >= table->num_words )
+    {
+        unsigned int k = __atomic_fetch_add( &next_thread, 1, __ATOMIC_RELAXED );
+        word_hint = (int)( ( k * 2654435761u ) % (unsigned int)table->num_words );
+    }
+
+    int w = word_hint;
+    for( int scanned = 0; scanned < table->num_words; )
+    {
+        if( w % WORDS_PER_GROUP == 0 &&
+            __atomic_load_n( &table->group_free[w / WORDS_PER_GROUP], __ATOMIC_RELAXED ) == 0 )
+        {
+            int step = table->num_words - w < WORDS_PER_GROUP ? table->num_words - w : WORDS_PER_GROUP;
+            w       += step;
+            scanned += step;
+        }
+        else
+        {
+            uint64_t old = __atomic_load_n( &table->words[w], __ATOMIC_RELAXED );
+            while( old != FULL_WORD )
+            {
+                uint64_t bit = ~old & ( old + 1 );
+                if( __atomic_compare_exchange_n( &table->words[w], &old, old | bit, 1,
+                                                 __ATOMIC_ACQ_REL, __ATOMIC_RELAXED ) )
+                {
+                    __atomic_fetch_sub( &table->group_free[w / WORDS_PER_GROUP], 1, __ATOMIC_RELAXED );
+                    __atomic_fetch_sub( &table->super_free[w / WORDS_PER_SUPER], 1, __ATOMIC_RELAXED );
+                    word_hint = w;
+                    return w * BITS_PER_WORD + __builtin_ctzll( bit );
+                }
+            }
+            w       += 1;
+            scanned += 1;
+        }
+        if( w >= table->num_words )
+        {
+            w = 0;
+        }
     }
+    return -1;
 }
 
-static char* read_table( )
+/* Release a block of the shared table for BAT_MODE_CONCURRENT.
+ * Returns 0 if the block was freed and -1 if it was not allocated.
+ */
+static int release_block( struct bat* table, int block )
 {
-    if( file_name == NULL )
+    if( block < 0 || block >= table->num_blocks )
     {
-        fprintf( stderr, "Failed to set the name of the block allocation table file.\n" );
-        exit( -1 );
+        fprintf( stderr, "Block number %d is not valid\n", block );
+        return -1;
     }
 
-    char* table = malloc( NUM_BLOCKS );
-    if( table == NULL )
+    uint64_t bit = (uint64_t)1 << ( block % BITS_PER_WORD );
+    uint64_t old = __atomic_fetch_and( &table->words[block / BITS_PER_WORD], ~bit, __ATOMIC_ACQ_REL );
+    if( !( old & bit ) )
     {
-        fprintf( stderr, "Failed to allocate %d bytes\n", NUM_BLOCKS );
-        return NULL;
+        fprintf( stderr, "Block %d was not allocated\n", block );
+        return -1;
     }
+    __atomic_fetch_add( &table->group_free[block / BLOCKS_PER_GROUP], 1, __ATOMIC_RELAXED );
+    __atomic_fetch_add( &table->super_free[block / BLOCKS_PER_SUPER], 1, __ATOMIC_RELAXED );
+    return 0;
+}
 
-    FILE* f = fopen( file_name, "r" );
-    if( !f )
+/* Write a copy of the shared table, taken word by word while other
+ * threads may go on allocating. Changes made after dirty_count was
+ * reset are counted again and written by the next flush.
+ */
+static int flush_shared_table( )
+{
+    int retval = 0;
+
+    pthread_mutex_lock( &flush_mutex );
+    struct bat* table   = __atomic_load_n( &cached_table, __ATOMIC_ACQUIRE );
+    int         pending = __atomic_exchange_n( &dirty_count, 0, __ATOMIC_ACQ_REL );
+    if( table != NULL && pending > 0 )
     {
-        fprintf( stderr, "Failed to open file %s for reading\n", file_name );
-        perror("reason:");
-        return NULL;
+        struct bat copy = *table;
+        copy.words = malloc( ( table->num_words ? table->num_words : 1 ) * sizeof(uint64_t) );
+        if( copy.words == NULL )
+        {
+            retval = -1;
+        }
+        else
+        {
+            for( int w=0; w<table->num_words; w++ )
+            {
+                copy.words[w] = __atomic_load_n( &table->words[w], __ATOMIC_RELAXED );
+            }
+            retval = write_table( &copy );
+            free( copy.words );
+        }
+        if( retval != 0 )
+        {
+            __atomic_add_fetch( &dirty_count, pending, __ATOMIC_RELAXED );
+        }
     }
+    pthread_mutex_unlock( &flush_mutex );
+    return retval;
+}
+
+/* The flusher thread writes the shared table whenever the number of
+ * changes reaches the flush threshold, so that allocating threads
+ * never wait for the file.
+ */
+static void* flusher_main( void* arg )
+{
+    (void)arg;
 
-    int num_read = fread( table, 1, NUM_BLOCKS, f );
-    if( num_read != NUM_BLOCKS )
+    pthread_mutex_lock( &table_lock );
+    for( ;; )
     {
-        fprintf( stderr, "Failed to load %d block entries from disk\n", NUM_BLOCKS );
-        perror("reason:");
-        fclose(f);
-        return NULL;
+        while( !flush_requested && !flusher_stop )
+        {
+            pthread_cond_wait( &flusher_wake, &table_lock );
+        }
+        if( flusher_stop )
+        {
+            break;
+        }
+        flush_requested = 0;
+
+        pthread_mutex_unlock( &table_lock );
+        flush_shared_table( );
+        pthread_mutex_lock( &table_lock );
     }
-    fclose( f );
+    pthread_mutex_unlock( &table_lock );
+    return NULL;
+}
 
-    return table;
+static void start_flusher( )
+{
+    pthread_mutex_lock( &table_lock );
+    if( !flusher_running )
+    {
+        flusher_stop    = 0;
+        flush_requested = 0;
+        if( pthread_create( &flusher_thread, NULL, flusher_main, NULL ) == 0 )
+        {
+            flusher_running = 1;
+        }
+    }
+    pthread_mutex_unlock( &table_lock );
 }
 
-static int write_table( char* table )
+static void stop_flusher( )
 {
-    if( file_name == NULL )
+    pthread_mutex_lock( &table_lock );
+    if( !flusher_running )
     {
-        fprintf( stderr, "Failed to set the name of the block allocation table file.\n" );
-        exit( -1 );
+        pthread_mutex_unlock( &table_lock );
+        return;
     }
+    flusher_stop = 1;
+    pthread_cond_signal( &flusher_wake );
+    pthread_mutex_unlock( &table_lock );
 
-    FILE* f = fopen( file_name, "w" );
-    if( !f )
+    pthread_join( flusher_thread, NULL );
+    flusher_running = 0;
+}
+
+/* Wake the flusher thread, or flush in the calling thread if there
+ * is none.
+ */
+static void request_flush( )
+{
+    pthread_mutex_lock( &table_lock );
+    int running = flusher_running;
+    if( running )
     {
-        fprintf( stderr, "Failed to open file %s for writing\n", file_name );
-        perror("reason:");
-        return -1;
+        flush_requested = 1;
+        pthread_cond_signal( &flusher_wake );
     }
-    int num = fwrite( table, 1, NUM_BLOCKS, f );
-    if( num != NUM_BLOCKS )
+    pthread_mutex_unlock( &table_lock );
+
+    if( !running )
     {
-        fprintf( stderr, "Failed to write %d bytes to %s\n", NUM_BLOCKS, file_name);
-        fprintf( stderr, "fwrite returned %d\n", num );
-        perror("reason:");
-        return -1;
+        flush_shared_table( );
     }
-    fclose( f );
-    return 0;
 }
 
 int format_disk()
@@ -106,22 +1218,50 @@ int format_disk()
         exit( -1 );
     }
 
+    if( table_mode == BAT_MODE_MMAP )
+    {
+        unmap_table( );
+    }
+
+    if( table_mode == BAT_MODE_CONCURRENT )
+    {
+        /* The table is replaced like in cached mode, with the flusher
+         * stopped so that it does not write the old one.
+         */
+        stop_flusher( );
+        table_mode = BAT_MODE_CACHED;
+        int retval = format_disk( );
+        table_mode = BAT_MODE_CONCURRENT;
+        start_flusher( );
+        return retval;
+    }
+
     int error = unlink( file_name );
 
     if( error == 0 || errno == ENOENT )
     {
-        /* We want to set all NUM_BLOCK chars to 0, convenient to use
-         * calloc.
-         */
-        char* table = calloc( NUM_BLOCKS, 1 );
+        struct bat* table = new_table( requested_size >= 0 ? requested_size : disk_size );
         if( table == NULL )
         {
-            fprintf( stderr, "Failed to allocate %d bytes\n", NUM_BLOCKS );
             return -1;
         }
 
         int retval = write_table( table );
-        free( table );
+        if( table_mode == BAT_MODE_CACHED )
+        {
+            free_table( cached_table );
+            cached_table = table;
+            dirty_count  = 0;
+        }
+        else
+        {
+            free_table( table );
+        }
+
+        if( retval == 0 && table_mode == BAT_MODE_MMAP )
+        {
+            retval = map_table( );
+        }
         return retval;
     }
 
@@ -132,65 +1272,345 @@ int format_disk()
 
 int allocate_block( )
 {
-    char* table = read_table( );
+    FS_STATS_TIME( FS_OP_ALLOCATE_BLOCK );
+
+    struct bat* table = get_table( );
+    if( table == NULL )
+    {
+        return -1;
+    }
+
+    if( table_mode == BAT_MODE_CONCURRENT )
+    {
+        int block = claim_block( table );
+        put_table( table, block >= 0 );
+        return block;
+    }
+
+    int block = find_free_block( table );
+    if( block < 0 )
+    {
+        put_table( table, 0 );
+        return -1;
+    }
+
+    mark_used( table, block );
+    put_table( table, 1 );
+    return block;
+}
+
+int allocate_blocks( int n, size_t* out )
+{
+    FS_STATS_TIME( FS_OP_ALLOCATE_BLOCKS );
+
+    if( n <= 0 )
+    {
+        return 0;
+    }
+
+    struct bat* table = get_table( );
     if( table == NULL )
     {
         return -1;
     }
 
-    for( int i=0; i<NUM_BLOCKS; i++ )
+    if( table_mode == BAT_MODE_CONCURRENT )
     {
-        if( table[i] == 0 )
+        for( int i=0; i<n; i++ )
         {
-            /* Found an unused block */
-            table[i] = 1;
-            write_table( table );
+            int block = claim_block( table );
+            if( block < 0 )
+            {
+                while( i > 0 )
+                {
+                    release_block( table, out[--i] );
+                }
+                return -1;
+            }
+            out[i] = block;
+        }
+        put_table( table, n );
+        return 0;
+    }
+
+    /* Collect the first n unused blocks before marking any of them,
+     * so that nothing changes if the disk does not have n blocks.
+     */
+    int found = 0;
+    int block = find_next_free( table, 0 );
+    while( block >= 0 && found < n )
+    {
+        out[found++] = block;
+        block = find_next_free( table, block + 1 );
+    }
+
+    if( found < n )
+    {
+        put_table( table, 0 );
+        return -1;
+    }
+
+    for( int i=0; i<n; i++ )
+    {
+        mark_used( table, out[i] );
+    }
+    put_table( table, n );
+    return 0;
+}
+
+int allocate_contiguous_blocks( int n, size_t* out )
+{
+    if( n <= 0 )
+    {
+        return 0;
+    }
+
+    /* The search for runs reads many words at once, which cannot be
+     * done atomically.
+     */
+    if( table_mode == BAT_MODE_CONCURRENT )
+    {
+        return allocate_blocks( n, out );
+    }
 
-            free( table );
-            return i;
+    struct bat* table = get_table( );
+    if( table == NULL )
+    {
+        return -1;
+    }
+
+    /* Best fit: the shortest run of unused blocks that is at least
+     * n blocks long.
+     */
+    int best_start = -1;
+    int best_len   = 0;
+    int start      = find_next_free( table, 0 );
+    while( start >= 0 )
+    {
+        int end = find_next_used( table, start );
+        int len = end - start;
+        if( len >= n && ( best_start < 0 || len < best_len ) )
+        {
+            best_start = start;
+            best_len   = len;
+            if( len == n ) break;
         }
+        start = find_next_free( table, end );
     }
 
-    free( table );
-    return -1;
+    if( best_start < 0 )
+    {
+        put_table( table, 0 );
+        return allocate_blocks( n, out );
+    }
+
+    for( int i=0; i<n; i++ )
+    {
+        out[i] = best_start + i;
+        mark_used( table, best_start + i );
+    }
+    put_table( table, n );
+    return 0;
 }
 
 int free_block(int block)
 {
-    if( block < 0 || block >= NUM_BLOCKS )
+    FS_STATS_TIME( FS_OP_FREE_BLOCK );
+
+    struct bat* table = get_table( );
+    if( table == NULL )
     {
-        fprintf( stderr, "Block number %d is not valid\n", block );
         return -1;
     }
 
-    char* table = read_table();
-    if( table == NULL )
+    if( table_mode == BAT_MODE_CONCURRENT )
+    {
+        int retval = release_block( table, block );
+        put_table( table, retval == 0 );
+        return retval;
+    }
+
+    if( block < 0 || block >= table->num_blocks )
     {
+        fprintf( stderr, "Block number %d is not valid\n", block );
+        put_table( table, 0 );
         return -1;
     }
 
-    if( table[block] != 1 )
+    if( !test_bit( table->words, block ) )
     {
         fprintf( stderr, "Block %d was not allocated\n", block );
-        free( table );
+        put_table( table, 0 );
         return -1;
     }
 
-    table[block] = 0;
+    mark_unused( table, block );
 
-    write_table( table );
-    free( table );
+    put_table( table, 1 );
 
     return 0;
 }
 
+int free_blocks( int n, const size_t* blocks )
+{
+    FS_STATS_TIME( FS_OP_FREE_BLOCKS );
+
+    if( n <= 0 )
+    {
+        return 0;
+    }
+
+    struct bat* table = get_table( );
+    if( table == NULL )
+    {
+        return -1;
+    }
+
+    int retval = 0;
+    int freed  = 0;
+
+    if( table_mode == BAT_MODE_CONCURRENT )
+    {
+        for( int i=0; i<n; i++ )
+        {
+            if( blocks[i] >= (size_t)table->num_blocks )
+            {
+                fprintf( stderr, "Block number %d is not valid\n", (int)blocks[i] );
+                retval = -1;
+            }
+            else if( release_block( table, (int)blocks[i] ) == 0 )
+            {
+                freed++;
+            }
+            else
+            {
+                retval = -1;
+            }
+        }
+        put_table( table, freed );
+        return retval;
+    }
+
+    for( int i=0; i<n; i++ )
+    {
+        if( blocks[i] >= (size_t)table->num_blocks )
+        {
+            fprintf( stderr, "Block number %d is not valid\n", (int)blocks[i] );
+            retval = -1;
+        }
+        else if( !test_bit( table->words, blocks[i] ) )
+        {
+            fprintf( stderr, "Block %d was not allocated\n", (int)blocks[i] );
+            retval = -1;
+        }
+        else
+        {
+            mark_unused( table, blocks[i] );
+            freed++;
+        }
+    }
+
+    if( put_table( table, freed ) != 0 )
+    {
+        retval = -1;
+    }
+    return retval;
+}
+
+int grow_disk( int new_blocks )
+{
+    if( table_mode == BAT_MODE_CONCURRENT )
+    {
+        /* The bitmap is reallocated, so the flusher must not copy it
+         * meanwhile. Other threads must not allocate either.
+         */
+        stop_flusher( );
+        table_mode = BAT_MODE_CACHED;
+        int retval = grow_disk( new_blocks );
+        table_mode = BAT_MODE_CONCURRENT;
+        start_flusher( );
+        return retval;
+    }
+
+    if( table_mode == BAT_MODE_MMAP )
+    {
+        /* A mapping cannot grow in place. The table is grown like in
+         * synchronous mode and mapped again afterwards.
+         */
+        unmap_table( );
+        table_mode = BAT_MODE_SYNCHRONOUS;
+        int retval = grow_disk( new_blocks );
+        table_mode = BAT_MODE_MMAP;
+        if( map_table( ) != 0 )
+        {
+            return -1;
+        }
+        return retval;
+    }
+
+    struct bat* table = get_table( );
+    if( table == NULL )
+    {
+        return -1;
+    }
+
+    if( new_blocks < table->num_blocks )
+    {
+        fprintf( stderr, "Cannot shrink the disk from %d to %d blocks\n", table->num_blocks, new_blocks );
+        put_table( table, 0 );
+        return -1;
+    }
+
+    int num_words = ( new_blocks + BITS_PER_WORD - 1 ) / BITS_PER_WORD;
+    if( num_words > table->num_words )
+    {
+        uint64_t* words = realloc( table->words, num_words * sizeof(uint64_t) );
+        if( words == NULL )
+        {
+            fprintf( stderr, "Failed to allocate %d bytes\n", (int)(num_words * sizeof(uint64_t)) );
+            put_table( table, 0 );
+            return -1;
+        }
+        memset( &words[table->num_words], 0, ( num_words - table->num_words ) * sizeof(uint64_t) );
+        table->words     = words;
+        table->num_words = num_words;
+    }
+
+    /* The padding bits of the old last word become real blocks.
+     */
+    for( int b=table->num_blocks; b<new_blocks; b++ )
+    {
+        clear_bit( table->words, b );
+    }
+
+    int added = new_blocks - table->num_blocks;
+    table->num_blocks = new_blocks;
+    set_padding_bits( table );
+    disk_size = new_blocks;
+
+    if( build_index( table ) != 0 )
+    {
+        put_table( table, 0 );
+        return -1;
+    }
+
+    /* The size change must reach the file even in cached mode.
+     */
+    if( put_table( table, added ) != 0 )
+    {
+        return -1;
+    }
+    return flush_block_allocation_table( );
+}
+
 void debug_disk( )
 {
-    char* table = read_table( );
+    struct bat* table = get_table( );
+    if( table == NULL ) return;
     printf("Disk:\n");
-    for( int i=0; i<NUM_BLOCKS; i++ )
-        printf("%d", table[i] );
+    for( int i=0; i<table->num_blocks; i++ )
+        printf("%d", test_bit( table->words, i ) );
     printf("\n");
-    free(table);
+    put_table( table, 0 );
 }
 
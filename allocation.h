@@ -1,17 +1,110 @@
 #ifndef ALLOCATION_H
 #define ALLOCATION_H
 
+#include <stddef.h>
+
+/* Modes for set_block_allocation_table_mode().
+ * BAT_MODE_SYNCHRONOUS reads and writes the table file for every
+ * allocate_block() and free_block() call.
+ * BAT_MODE_CACHED reads the table file once and keeps it in memory.
+ * Changes are written back by flush_block_allocation_table(), by
+ * release_block_allocation_table_name(), or when the number of
+ * changed blocks reaches the flush threshold.
+ * BAT_MODE_MMAP maps the table file into memory and changes the
+ * mapped bitmap directly. The same events as in cached mode make
+ * the changes durable with msync(). A table in BAT_FORMAT_BYTES is
+ * converted to BAT_FORMAT_BITMAP when it is mapped.
+ * BAT_MODE_CONCURRENT keeps the table in memory like cached mode, but
+ * allocate_block(), allocate_blocks(), free_block() and free_blocks()
+ * may be called from several threads at once. Blocks are claimed with
+ * compare-and-swap on the words of the bitmap, and every thread starts
+ * searching where it last found a block, so allocated blocks are not
+ * necessarily the lowest unused ones, and allocate_contiguous_blocks()
+ * behaves like allocate_blocks(). A background thread writes the table
+ * when the flush threshold is reached; allocating threads never write
+ * it. The other functions of this file must not run concurrently with
+ * any allocation.
+ */
+#define BAT_MODE_SYNCHRONOUS 0
+#define BAT_MODE_CACHED      1
+#define BAT_MODE_MMAP        2
+#define BAT_MODE_CONCURRENT  3
+
+/* File formats for set_block_allocation_table_format().
+ * BAT_FORMAT_BYTES stores one byte per block, 0 for unused and 1 for
+ * used blocks. The number of blocks is the size of the file.
+ * BAT_FORMAT_BITMAP stores a header with the number of blocks,
+ * followed by one bit per block, block b in bit b%8 of byte b/8.
+ * In memory, the table is always kept as a bitmap.
+ */
+#define BAT_FORMAT_BYTES     0
+#define BAT_FORMAT_BITMAP    1
+
 /* Set the name of block allocation table file.
  * This is necessary to have several examples in the same
  * directory.
+ * If the file exists already, its format and number of blocks
+ * become the format and size of the disk.
  */
 void set_block_allocation_table_name( char* str );
 
 /* Release the memory for the block allocation table file
  * name before exit().
+ * In cached mode, unwritten changes are flushed first.
  */
 void release_block_allocation_table_name( );
 
+/* Select BAT_MODE_SYNCHRONOUS (the default), BAT_MODE_CACHED,
+ * BAT_MODE_MMAP or BAT_MODE_CONCURRENT. Switching modes flushes the
+ * cached or mapped table. In mmap mode, the table file is mapped when
+ * its name is set or when the disk is formatted.
+ */
+void set_block_allocation_table_mode( int mode );
+
+/* Select the file format in which the block allocation table is
+ * written, BAT_FORMAT_BYTES (the default) or BAT_FORMAT_BITMAP.
+ * An existing table is converted the next time it is written.
+ */
+void set_block_allocation_table_format( int format );
+
+/* In cached mode, the table is written back automatically once
+ * dirty_blocks blocks have been allocated or freed since the last
+ * write. A value of 0 or less disables the automatic write-back.
+ */
+void set_block_allocation_table_flush_threshold( int dirty_blocks );
+
+/* Write the cached table back to its file if it has been changed,
+ * or msync() the mapped table in mmap mode.
+ * Does nothing in synchronous mode.
+ * Returns 0 in case of success and -1 if the file cannot be written.
+ */
+int flush_block_allocation_table( );
+
+/* Read the block allocation table file src and write it to the
+ * file dst in dst_format. This converts between the byte per block
+ * and the bitmap file formats. src_format is only used if src has
+ * no header.
+ * Returns 0 in case of success and -1 otherwise.
+ */
+int convert_block_allocation_table( char* src, int src_format, char* dst, int dst_format );
+
+/* Set the number of blocks that format_disk() creates. Without it,
+ * format_disk() keeps the size of an existing table file, or uses
+ * 50 blocks.
+ */
+void set_disk_size( int num_blocks );
+
+/* Return the number of blocks of the disk.
+ */
+int get_disk_size( );
+
+/* Extend the disk to new_blocks blocks in total. The new blocks are
+ * unused, all existing allocations are kept.
+ * Returns 0 in case of success and -1 if new_blocks is smaller than
+ * the current size or the table cannot be written.
+ */
+int grow_disk( int new_blocks );
+
 /* Set all the blocks in our simulated disk into an unused
  * state.
  * This function returns 0 in case of success and -1 if the
@@ -25,12 +118,34 @@ int format_disk();
  */
 int allocate_block();
 
+/* Allocate n blocks at once and store their numbers in out, which
+ * must have room for n entries. The blocks are the first n unused
+ * blocks, as n calls of allocate_block() would return them, but the
+ * table is searched and written only once.
+ * Either all n blocks are allocated and 0 is returned, or none is
+ * allocated and -1 is returned.
+ */
+int allocate_blocks( int n, size_t* out );
+
+/* Like allocate_blocks(), but prefers n consecutive blocks. The
+ * shortest run of unused blocks that can hold all n blocks is used.
+ * If there is no such run, the first n unused blocks are allocated.
+ */
+int allocate_contiguous_blocks( int n, size_t* out );
+
 /* Free the block with the given ID.
  * This functions returns 0 if the block was freed
  * or -1 if the block with this ID was not allocated.
  */
 int free_block(int block);
 
+/* Free the n blocks in blocks with a single read and write of the
+ * table. Blocks that are not valid or not allocated are reported and
+ * skipped; all others are freed.
+ * Returns 0 if all n blocks were freed and -1 otherwise.
+ */
+int free_blocks( int n, const size_t* blocks );
+
 /* This debug function prints the table to stdout. */
 void debug_disk();
 
@@ -0,0 +1,181 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "arena.h"
+
+/* Every allocation is rounded up to this alignment.
+ */
+#define ARENA_ALIGN 16
+
+struct region
+{
+    struct region* next;
+    size_t         size;
+    size_t         used;
+    _Alignas(ARENA_ALIGN) unsigned char data[];
+};
+
+struct arena
+{
+    size_t         region_size;
+    struct region* regions;
+};
+
+struct slab
+{
+    struct arena* arena;
+    size_t        object_size;
+    void*         free_list;
+};
+
+static struct region* new_region( size_t size )
+{
+    struct region* region = malloc( sizeof(struct region) + size );
+    if( region == NULL )
+    {
+        fprintf( stderr, "Failed to allocate %zu bytes\n", sizeof(struct region) + size );
+        return NULL;
+    }
+    region->next = NULL;
+    region->size = size;
+    region->used = 0;
+    return region;
+}
+
+struct arena* arena_create( size_t region_size )
+{
+    struct arena* arena = malloc( sizeof(struct arena) );
+    if( arena == NULL )
+    {
+        return NULL;
+    }
+    arena->region_size = region_size;
+    arena->regions     = NULL;
+    return arena;
+}
+
+void* arena_alloc( struct arena* arena, size_t size )
+{
+    size = ( size + ARENA_ALIGN - 1 ) & ~(size_t)( ARENA_ALIGN - 1 );
+    if( size == 0 )
+    {
+        size = ARENA_ALIGN;
+    }
+
+    struct region* region = arena->regions;
+    if( region == NULL || region->size - region->used < size )
+    {
+        if( size > arena->region_size )
+        {
+            /* A large request gets its own region, which is put behind
+             * the current one so that its free space is not lost.
+             */
+            struct region* large = new_region( size );
+            if( large == NULL )
+            {
+                return NULL;
+            }
+            large->used = size;
+            if( region )
+            {
+                large->next  = region->next;
+                region->next = large;
+            }
+            else
+            {
+                arena->regions = large;
+            }
+            memset( large->data, 0, size );
+            return large->data;
+        }
+
+        region = new_region( arena->region_size );
+        if( region == NULL )
+        {
+            return NULL;
+        }
+        region->next   = arena->regions;
+        arena->regions = region;
+    }
+
+    void* ptr = &region->data[region->used];
+    region->used += size;
+    memset( ptr, 0, size );
+    return ptr;
+}
+
+void arena_destroy( struct arena* arena )
+{
+    if( arena == NULL )
+    {
+        return;
+    }
+
+    struct region* region = arena->regions;
+    while( region )
+    {
+        struct region* next = region->next;
+        free( region );
+        region = next;
+    }
+    free( arena );
+}
+
+struct slab* slab_create( size_t object_size, int objects_per_region )
+{
+    struct slab* slab = malloc( sizeof(struct slab) );
+    if( slab == NULL )
+    {
+        return NULL;
+    }
+
+    if( object_size < sizeof(void*) )
+    {
+        object_size = sizeof(void*);
+    }
+    object_size = ( object_size + ARENA_ALIGN - 1 ) & ~(size_t)( ARENA_ALIGN - 1 );
+
+    slab->arena = arena_create( object_size * objects_per_region );
+    if( slab->arena == NULL )
+    {
+        free( slab );
+        return NULL;
+    }
+    slab->object_size = object_size;
+    slab->free_list   = NULL;
+    return slab;
+}
+
+void* slab_alloc( struct slab* slab )
+{
+    if( slab->free_list )
+    {
+        void* object    = slab->free_list;
+        slab->free_list = *(void**)object;
+        memset( object, 0, slab->object_size );
+        return object;
+    }
+    return arena_alloc( slab->arena, slab->object_size );
+}
+
+void slab_free( struct slab* slab, void* object )
+{
+    if( object == NULL )
+    {
+        return;
+    }
+    *(void**)object = slab->free_list;
+    slab->free_list = object;
+}
+
+void slab_destroy( struct slab* slab )
+{
+    if( slab == NULL )
+    {
+        return;
+    }
+    arena_destroy( slab->arena );
+    free( slab );
+}
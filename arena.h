@@ -0,0 +1,51 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/* An arena hands out memory from large regions by moving a pointer
+ * forward. Single allocations cannot be released; all of them are
+ * released together by arena_destroy(), which frees one region at a
+ * time.
+ */
+struct arena;
+
+/* Create an arena that gets its memory in regions of region_size
+ * bytes. Returns NULL if memory runs out.
+ */
+struct arena* arena_create( size_t region_size );
+
+/* Return size bytes of zeroed memory, aligned for any type, or NULL
+ * if memory runs out. Requests larger than the region size get a
+ * region of their own.
+ */
+void* arena_alloc( struct arena* arena, size_t size );
+
+/* Release all memory of the arena and the arena itself.
+ */
+void arena_destroy( struct arena* arena );
+
+/* A slab hands out objects of one fixed size from an arena, and keeps
+ * released objects in a free list for reuse.
+ */
+struct slab;
+
+/* Create a slab for objects of object_size bytes, which gets its
+ * memory in regions of objects_per_region objects.
+ * Returns NULL if memory runs out.
+ */
+struct slab* slab_create( size_t object_size, int objects_per_region );
+
+/* Return one zeroed object, or NULL if memory runs out.
+ */
+void* slab_alloc( struct slab* slab );
+
+/* Put the object back into the free list of the slab.
+ */
+void slab_free( struct slab* slab, void* object );
+
+/* Release all objects of the slab and the slab itself.
+ */
+void slab_destroy( struct slab* slab );
+
+#endif // ARENA_H
@@ -0,0 +1,142 @@
+#include "inode.h"
+#include "allocation.h"
+
+#include <stdio.h>
+
+/* Count the inodes that differ between two trees. Ids, names, sizes
+ * and blocks must all be the same.
+ */
+static int compare_trees( struct inode* a, struct inode* b )
+{
+    if( a == NULL || b == NULL ) return !( a == NULL && b == NULL );
+
+    if( a->id != b->id || strcmp( a->name, b->name ) != 0 ||
+        a->is_directory != b->is_directory )
+        return 1;
+
+    if( !a->is_directory )
+    {
+        if( a->filesize != b->filesize || a->num_blocks != b->num_blocks ) return 1;
+
+        struct block_iterator it_a;
+        struct block_iterator it_b;
+        size_t block_a;
+        size_t block_b;
+        block_iterator_init( &it_a, a );
+        block_iterator_init( &it_b, b );
+        while( block_iterator_next( &it_a, &block_a ) )
+        {
+            if( !block_iterator_next( &it_b, &block_b ) || block_a != block_b ) return 1;
+        }
+        return 0;
+    }
+
+    if( a->num_children != b->num_children ) return 1;
+
+    int differences = 0;
+    for( int i = 0; i < a->num_children; i++ )
+    {
+        differences += compare_trees( a->children[i], b->children[i] );
+    }
+    return differences;
+}
+
+/* Count the inodes of the tree that come from the arena and from
+ * malloc.
+ */
+static void count_inodes( struct inode* node, int* arena, int* heap )
+{
+    if( node->in_arena ) (*arena)++;
+    else                 (*heap)++;
+
+    for( int i = 0; i < node->num_children; i++ )
+    {
+        count_inodes( node->children[i], arena, heap );
+    }
+}
+
+static void print_tree( const char* what, struct inode* root, struct inode* expected )
+{
+    int arena = 0;
+    int heap  = 0;
+    count_inodes( root, &arena, &heap );
+    printf("%-26s %4d arena inodes, %4d heap inodes, %d differ\n",
+           what, arena, heap, compare_trees( expected, root ) );
+}
+
+int main( int argc, char* argv[] )
+{
+    if( argc != 3 )
+    {
+        fprintf( stderr, "This program creates a file system in the arena mode, saves it to the master\n"
+                         "file table (MFT) and loads it again, into the arena and with malloc. The\n"
+                         "trees are released in an order that leaves the arena tree for last, and\n"
+                         "then a tree that mixes arena and heap inodes is created and released. Each\n"
+                         "tree is compared with the tree that was saved.\n"
+                         "\n"
+                         "Usage: %s MFT BAT\n"
+                         "       where\n"
+                         "       MFT is the name of the master file table\n"
+                         "       BAT is the name of the block allocation table\n"
+                         , argv[0] );
+        exit( -1 );
+    }
+
+    char* mft_name = argv[1];
+    char* bat_name = argv[2];
+    char  name[32];
+
+    set_block_allocation_table_name( bat_name );
+    set_disk_size( 4096 );
+    format_disk();
+
+    set_inode_arena( 1 );
+    struct inode* root = create_dir( NULL, "/" );
+    for( int d = 0; d < 10; d++ )
+    {
+        snprintf( name, sizeof(name), "d%d", d );
+        struct inode* dir = create_dir( root, name );
+        for( int f = 0; f < 100; f++ )
+        {
+            snprintf( name, sizeof(name), "f%d", f );
+            create_file( dir, name, f * 100 );
+        }
+    }
+    save_inodes( mft_name, root );
+    print_tree( "Created in the arena:", root, root );
+
+    struct inode* arena_copy = load_inodes( mft_name );
+    print_tree( "Loaded into the arena:", arena_copy, root );
+    set_inode_arena( 0 );
+    struct inode* heap_copy = load_inodes( mft_name );
+    print_tree( "Loaded with malloc:", heap_copy, root );
+
+    /* The arena copy must survive the release of the other trees. The
+     * last fs_shutdown() releases it without visiting its inodes.
+     */
+    fs_shutdown( root );
+    print_tree( "After the first release:", arena_copy, heap_copy );
+    fs_shutdown( heap_copy );
+    print_tree( "After the second release:", arena_copy, arena_copy );
+    fs_shutdown( arena_copy );
+
+    /* A mixed tree is walked, and the arena goes with its last inode.
+     */
+    set_inode_arena( 1 );
+    struct inode* mixed = load_inodes( mft_name );
+    set_inode_arena( 0 );
+    create_file( lookup_path( mixed, "/d3" ), "notes", 5000 );
+    create_dir( mixed, "home" );
+    print_tree( "Mixed tree:", mixed, mixed );
+    fs_shutdown( mixed );
+
+    set_inode_arena( 1 );
+    struct inode* again = load_inodes( mft_name );
+    set_inode_arena( 0 );
+    struct inode* expected = load_inodes( mft_name );
+    print_tree( "Loaded into a new arena:", again, expected );
+    fs_shutdown( expected );
+    fs_shutdown( again );
+
+    release_block_allocation_table_name( );
+}
@@ -0,0 +1,340 @@
+#include "allocation.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+static const char* mode_names[]   = { "synchronous", "cached", "mmap" };
+static const char* format_names[] = { "bytes", "bitmap" };
+
+#define NUM_MODES   3
+#define NUM_FORMATS 2
+
+#define LARGE_DISK  600000
+
+#define NUM_THREADS       4
+#define BLOCKS_PER_THREAD 2000
+#define CONCURRENT_DISK   8192
+
+#define PATH_LENGTH 256
+
+static void table_path( char* path, const char* dir, const char* name )
+{
+    snprintf( path, PATH_LENGTH, "%s/%s", dir, name );
+}
+
+/* Return 1 if both files exist and have the same contents.
+ */
+static int same_files( char* a, char* b )
+{
+    FILE* fa = fopen( a, "rb" );
+    FILE* fb = fopen( b, "rb" );
+    int   same = ( fa != NULL && fb != NULL );
+    while( same )
+    {
+        int ca = fgetc( fa );
+        int cb = fgetc( fb );
+        if( ca != cb ) same = 0;
+        if( ca == EOF ) break;
+    }
+    if( fa ) fclose( fa );
+    if( fb ) fclose( fb );
+    return same;
+}
+
+/* Count the used blocks in a table file in the byte per block format.
+ */
+static int used_blocks_in_file( char* name )
+{
+    FILE* file = fopen( name, "rb" );
+    int   used = 0;
+    int   c;
+    if( file == NULL ) return -1;
+    while( ( c = fgetc( file ) ) != EOF )
+    {
+        if( c ) used++;
+    }
+    fclose( file );
+    return used;
+}
+
+/* The same allocations and frees for every mode and format.
+ */
+static void run_operations( )
+{
+    for( int i = 0; i < 30; i++ ) allocate_block();
+    for( int b = 1; b < 30; b += 3 ) free_block( b );
+    for( int i = 0; i < 5; i++ ) allocate_block();
+    free_block( 0 );
+    free_block( 29 );
+}
+
+/* The blocks that one allocating thread holds at the end.
+ */
+struct held_blocks
+{
+    size_t blocks[BLOCKS_PER_THREAD];
+    int    num_blocks;
+    int    failed;
+};
+
+/* Allocate blocks one by one, free every second of them and allocate
+ * a few hundred more in one call.
+ */
+static void* allocating_thread( void* arg )
+{
+    struct held_blocks* held = arg;
+    size_t              freed[BLOCKS_PER_THREAD / 2];
+
+    held->num_blocks = 0;
+    held->failed     = 0;
+    for( int i = 0; i < BLOCKS_PER_THREAD; i++ )
+    {
+        int block = allocate_block();
+        if( block < 0 )
+        {
+            held->failed++;
+            continue;
+        }
+        if( i % 2 ) held->blocks[held->num_blocks++] = block;
+        else        free_block( block );
+    }
+
+    int n = BLOCKS_PER_THREAD / 4;
+    if( allocate_blocks( n, freed ) == 0 )
+    {
+        memcpy( &held->blocks[held->num_blocks], freed, n * sizeof(size_t) );
+        held->num_blocks += n;
+    }
+    else
+    {
+        held->failed++;
+    }
+    return NULL;
+}
+
+/* Run NUM_THREADS allocating threads on a table in concurrent mode,
+ * with a low flush threshold, so that the flusher thread writes the
+ * table while they run. Then check that no block is held twice and
+ * that the table file marks exactly the held blocks as used.
+ */
+static void run_concurrent( char* table, char* copy, int format )
+{
+    static struct held_blocks held[NUM_THREADS];
+    pthread_t                 threads[NUM_THREADS];
+
+    remove( table );
+    set_block_allocation_table_format( format );
+    set_block_allocation_table_mode( BAT_MODE_CONCURRENT );
+    set_block_allocation_table_flush_threshold( 64 );
+    set_disk_size( CONCURRENT_DISK );
+    set_block_allocation_table_name( table );
+    format_disk();
+    for( int t = 0; t < NUM_THREADS; t++ )
+    {
+        pthread_create( &threads[t], NULL, allocating_thread, &held[t] );
+    }
+    for( int t = 0; t < NUM_THREADS; t++ )
+    {
+        pthread_join( threads[t], NULL );
+    }
+    release_block_allocation_table_name( );
+    set_block_allocation_table_mode( BAT_MODE_SYNCHRONOUS );
+
+    unsigned char* seen       = calloc( CONCURRENT_DISK, 1 );
+    int            total      = 0;
+    int            failed     = 0;
+    int            duplicates = 0;
+    if( seen == NULL )
+    {
+        fprintf( stderr, "Memory allocation failed\n" );
+        exit( -1 );
+    }
+    for( int t = 0; t < NUM_THREADS; t++ )
+    {
+        for( int i = 0; i < held[t].num_blocks; i++ )
+        {
+            size_t block = held[t].blocks[i];
+            if( block >= CONCURRENT_DISK || seen[block] ) duplicates++;
+            else                                         seen[block] = 1;
+        }
+        total  += held[t].num_blocks;
+        failed += held[t].failed;
+    }
+    free( seen );
+
+    convert_block_allocation_table( table, format, copy, BAT_FORMAT_BYTES );
+    printf("concurrent  %-6s: %d threads hold %d blocks, %d failed, %d duplicates, %d used in the file\n",
+           format_names[format], NUM_THREADS, total, failed, duplicates, used_blocks_in_file( copy ) );
+}
+
+int main( int argc, char* argv[] )
+{
+    if( argc != 2 )
+    {
+        fprintf( stderr, "This program runs the same allocations on a block allocation table in every\n"
+                         "mode and file format, converts each table to the byte per block format and\n"
+                         "compares it with the table of the synchronous mode. Then it checks that the\n"
+                         "cached mode writes the file when the flush threshold is reached, and grows\n"
+                         "a nearly full disk in every mode and format, and searches a large full disk\n"
+                         "for a few unused blocks. Finally, several threads allocate and free blocks\n"
+                         "at once in the concurrent mode.\n"
+                         "\n"
+                         "Usage: %s DIR\n"
+                         "       where\n"
+                         "       DIR is the directory for the table files\n"
+                         , argv[0] );
+        exit( -1 );
+    }
+
+    char* dir = argv[1];
+    char  reference[PATH_LENGTH];
+    char  table[PATH_LENGTH];
+    char  copy[PATH_LENGTH];
+    table_path( reference, dir, "reference" );
+    table_path( copy, dir, "copy" );
+
+    for( int mode = 0; mode < NUM_MODES; mode++ )
+    {
+        for( int format = 0; format < NUM_FORMATS; format++ )
+        {
+            char name[64];
+            snprintf( name, sizeof(name), "%s_%s", mode_names[mode], format_names[format] );
+            table_path( table, dir, name );
+
+            remove( table );
+            set_block_allocation_table_format( format );
+            set_block_allocation_table_mode( mode );
+            set_block_allocation_table_name( table );
+            format_disk();
+            run_operations( );
+            release_block_allocation_table_name( );
+            set_block_allocation_table_mode( BAT_MODE_SYNCHRONOUS );
+
+            if( mode == 0 && format == 0 )
+            {
+                convert_block_allocation_table( table, format, reference, BAT_FORMAT_BYTES );
+                continue;
+            }
+            convert_block_allocation_table( table, format, copy, BAT_FORMAT_BYTES );
+            printf("%-11s %-6s: %s\n", mode_names[mode], format_names[format],
+                   same_files( reference, copy ) ? "same table" : "DIFFERENT table" );
+        }
+    }
+
+    /* Convert the reference to a bitmap and back.
+     */
+    table_path( table, dir, "converted_bitmap" );
+    convert_block_allocation_table( reference, BAT_FORMAT_BYTES, table, BAT_FORMAT_BITMAP );
+    convert_block_allocation_table( table, BAT_FORMAT_BITMAP, copy, BAT_FORMAT_BYTES );
+    printf("bytes -> bitmap -> bytes: %s\n", same_files( reference, copy ) ? "same table" : "DIFFERENT table" );
+
+    set_block_allocation_table_format( BAT_FORMAT_BYTES );
+    set_block_allocation_table_name( reference );
+    debug_disk();
+    release_block_allocation_table_name( );
+
+    /* In cached mode, the file is only written when the flush
+     * threshold is reached.
+     */
+    table_path( table, dir, "threshold" );
+    remove( table );
+    set_block_allocation_table_mode( BAT_MODE_CACHED );
+    set_block_allocation_table_flush_threshold( 4 );
+    set_block_allocation_table_name( table );
+    format_disk();
+    for( int i = 0; i < 3; i++ ) allocate_block();
+    printf("After 3 allocations, the file has %d used blocks\n", used_blocks_in_file( table ) );
+    allocate_block();
+    printf("After 4 allocations, the file has %d used blocks\n", used_blocks_in_file( table ) );
+    release_block_allocation_table_name( );
+
+    /* Grow a nearly full disk. The size of the grown table must be
+     * read back from its file.
+     */
+    for( int mode = 0; mode < NUM_MODES; mode++ )
+    {
+        for( int format = 0; format < NUM_FORMATS; format++ )
+        {
+            char name[64];
+            snprintf( name, sizeof(name), "grow_%s_%s", mode_names[mode], format_names[format] );
+            table_path( table, dir, name );
+
+            remove( table );
+            set_block_allocation_table_format( format );
+            set_block_allocation_table_mode( mode );
+            set_disk_size( 100 );
+            set_block_allocation_table_name( table );
+            format_disk();
+            for( int i = 0; i < 90; i++ ) allocate_block();
+            int grown  = grow_disk( 200 );
+            int last   = -1;
+            for( int i = 0; i < 20; i++ ) last = allocate_block();
+            int shrunk = grow_disk( 150 );
+            release_block_allocation_table_name( );
+            set_block_allocation_table_mode( BAT_MODE_SYNCHRONOUS );
+
+            set_block_allocation_table_name( table );
+            int size = get_disk_size( );
+            release_block_allocation_table_name( );
+            convert_block_allocation_table( table, format, copy, BAT_FORMAT_BYTES );
+
+            printf("%-11s %-6s: grow %d, last block %d, shrink %d, %d blocks with %d used in the file\n",
+                   mode_names[mode], format_names[format], grown, last, shrunk,
+                   size, used_blocks_in_file( copy ) );
+        }
+    }
+
+    /* A disk with three super groups that is full except for a few
+     * holes, which the searches must find without scanning the whole
+     * table.
+     */
+    size_t* blocks = malloc( LARGE_DISK * sizeof(size_t) );
+    if( blocks == NULL )
+    {
+        fprintf( stderr, "Memory allocation failed\n" );
+        exit( -1 );
+    }
+    for( int mode = 0; mode < NUM_MODES; mode++ )
+    {
+        char name[64];
+        snprintf( name, sizeof(name), "large_%s", mode_names[mode] );
+        table_path( table, dir, name );
+
+        remove( table );
+        set_block_allocation_table_format( BAT_FORMAT_BITMAP );
+        set_block_allocation_table_mode( mode );
+        set_disk_size( LARGE_DISK );
+        set_block_allocation_table_name( table );
+        format_disk();
+        allocate_blocks( LARGE_DISK, blocks );
+        int full = allocate_block();
+        free_block( 555555 );
+        int single = allocate_block();
+
+        free_block( 100 );
+        for( int b = 300000; b < 300003; b++ ) free_block( b );
+        for( int b = 400000; b < 400010; b++ ) free_block( b );
+        size_t three[3];
+        size_t five[5];
+        size_t two[2];
+        allocate_contiguous_blocks( 3, three );
+        allocate_contiguous_blocks( 5, five );
+        allocate_blocks( 2, two );
+        release_block_allocation_table_name( );
+        set_block_allocation_table_mode( BAT_MODE_SYNCHRONOUS );
+
+        printf("%-11s large : full %d, single %d, runs %zu..%zu and %zu..%zu, then %zu and %zu\n",
+               mode_names[mode], full, single, three[0], three[2], five[0], five[4], two[0], two[1] );
+    }
+    free( blocks );
+
+    for( int format = 0; format < NUM_FORMATS; format++ )
+    {
+        char name[64];
+        snprintf( name, sizeof(name), "concurrent_%s", format_names[format] );
+        table_path( table, dir, name );
+        run_concurrent( table, copy, format );
+    }
+}
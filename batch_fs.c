@@ -0,0 +1,150 @@
+#include "inode.h"
+#include "allocation.h"
+
+#include <stdio.h>
+
+/* The entries of the manifest that the test passes to the program.
+ */
+static const struct create_entry manifest_entries[] =
+{
+    { "/usr",           "bin",   CREATE_ENTRY_DIRECTORY, 0 },
+    { "/usr",           "local", CREATE_ENTRY_DIRECTORY, 0 },
+    { "/usr/bin",       "ls",    CREATE_ENTRY_FILE,      14322 },
+    { "/usr/bin",       "ps",    CREATE_ENTRY_FILE,      9000 },
+    { "/usr/local",     "bin",   CREATE_ENTRY_DIRECTORY, 0 },
+    { "/usr/local/bin", "gcc",   CREATE_ENTRY_FILE,      12623 },
+};
+
+#define NUM_MANIFEST_ENTRIES ( sizeof(manifest_entries) / sizeof(manifest_entries[0]) )
+
+/* Count the blocks that are marked as used in the block allocation
+ * table file.
+ */
+static int used_blocks_in_file( char* name )
+{
+    FILE* file = fopen( name, "rb" );
+    int   used = 0;
+    int   c;
+    if( file == NULL ) return -1;
+    while( ( c = fgetc( file ) ) != EOF )
+    {
+        if( c ) used++;
+    }
+    fclose( file );
+    return used;
+}
+
+/* Count the inodes that differ between two trees that were created on
+ * freshly formatted disks. The ids of b are id_offset larger than those
+ * of a; names, sizes and blocks must be the same.
+ */
+static int compare_trees( struct inode* a, struct inode* b, int id_offset )
+{
+    if( a == NULL || b == NULL ) return !( a == NULL && b == NULL );
+
+    if( a->id + id_offset != b->id || strcmp( a->name, b->name ) != 0 ||
+        a->is_directory != b->is_directory )
+        return 1;
+
+    if( !a->is_directory )
+    {
+        if( a->filesize != b->filesize || a->num_blocks != b->num_blocks ) return 1;
+
+        struct block_iterator it_a;
+        struct block_iterator it_b;
+        size_t block_a;
+        size_t block_b;
+        block_iterator_init( &it_a, a );
+        block_iterator_init( &it_b, b );
+        while( block_iterator_next( &it_a, &block_a ) )
+        {
+            if( !block_iterator_next( &it_b, &block_b ) || block_a != block_b ) return 1;
+        }
+        return 0;
+    }
+
+    if( a->num_children != b->num_children ) return 1;
+
+    int differences = 0;
+    for( int i = 0; i < a->num_children; i++ )
+    {
+        differences += compare_trees( a->children[i], b->children[i], id_offset );
+    }
+    return differences;
+}
+
+static struct inode* create_root( )
+{
+    struct inode* root = create_dir( NULL, "/" );
+    create_dir( root, "etc" );
+    create_dir( root, "usr" );
+    return root;
+}
+
+int main( int argc, char* argv[] )
+{
+    if( argc != 4 )
+    {
+        fprintf( stderr, "This program adds files and directories to a small file system with\n"
+                         "create_batch(). The second entry of the first batch names a parent that\n"
+                         "does not exist, so only the first entry is created and no blocks are left\n"
+                         "allocated for the others. Then the entries of a manifest are created and\n"
+                         "compared with a tree that got one create_file() or create_dir() call per\n"
+                         "entry, and a broken manifest is rejected.\n"
+                         "\n"
+                         "Usage: %s BAT MANIFEST BROKEN\n"
+                         "       where\n"
+                         "       BAT is the name of the block allocation table\n"
+                         "       MANIFEST is the name of a manifest for create_batch_from_manifest()\n"
+                         "       BROKEN is the name of a manifest with an error\n"
+                         , argv[0] );
+        exit( -1 );
+    }
+
+    char* bat_name    = argv[1];
+    char* manifest    = argv[2];
+    char* broken_name = argv[3];
+
+    set_block_allocation_table_name( bat_name );
+    set_disk_size( 50 );
+    format_disk();
+
+    struct inode* root = create_root( );
+    struct create_entry entries[] =
+    {
+        { "/etc", "hosts",  CREATE_ENTRY_FILE, 200 },
+        { "/opt", "tool",   CREATE_ENTRY_FILE, 5000 },
+        { "/etc", "passwd", CREATE_ENTRY_FILE, 300 },
+    };
+    printf("Batch with a missing parent: created %d of 3 entries\n", create_batch( root, entries, 3 ) );
+    printf("/etc/hosts is %s\n",  lookup_path( root, "/etc/hosts" )  ? "there" : "missing" );
+    printf("/opt/tool is %s\n",   lookup_path( root, "/opt/tool" )   ? "there" : "missing" );
+    printf("/etc/passwd is %s\n", lookup_path( root, "/etc/passwd" ) ? "there" : "missing" );
+    printf("Used blocks: %d\n", used_blocks_in_file( bat_name ) );
+    fs_shutdown( root );
+
+    format_disk();
+    struct inode* single = create_root( );
+    for( size_t i = 0; i < NUM_MANIFEST_ENTRIES; i++ )
+    {
+        const struct create_entry* e      = &manifest_entries[i];
+        struct inode*              parent = lookup_path( single, (char*)e->parent );
+        if( e->type == CREATE_ENTRY_FILE ) create_file( parent, (char*)e->name, e->size );
+        else                               create_dir( parent, (char*)e->name );
+    }
+
+    format_disk();
+    root = create_root( );
+    printf("Manifest: created %d entries\n", create_batch_from_manifest( root, manifest ) );
+    printf("Inodes that differ from one call per entry: %d\n",
+           compare_trees( single, root, root->id - single->id ) );
+    printf("Used blocks: %d\n", used_blocks_in_file( bat_name ) );
+
+    printf("Broken manifest: create_batch_from_manifest returned %d\n",
+           create_batch_from_manifest( root, broken_name ) );
+    printf("/usr/share is %s\n", lookup_path( root, "/usr/share" ) ? "there" : "missing" );
+
+    fs_shutdown( single );
+    fs_shutdown( root );
+    release_block_allocation_table_name( );
+}
@@ -0,0 +1,383 @@
+#include "inode.h"
+#include "allocation.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+
+#define SIZES_FIXED       0
+#define SIZES_UNIFORM     1
+#define SIZES_EXPONENTIAL 2
+
+/* Parameters of the synthetic tree and of the run. The tree has
+ * directories with fanout subdirectories each, depth levels deep,
+ * and the remaining inodes are files spread evenly over them.
+ */
+struct bench_config
+{
+    int         num_inodes;
+    int         fanout;
+    int         depth;
+    int         size_mean;
+    int         size_dist;
+    int         bat_mode;
+    int         iterations;
+    int         num_allocations;
+    unsigned    seed;
+    const char* dir;
+};
+
+/* The latencies of one benchmark in nanoseconds.
+ */
+struct bench_timer
+{
+    const char* name;
+    long        count;
+    long        capacity;
+    long*       samples;
+    double      total;
+};
+
+static double now_seconds( )
+{
+    struct timespec t;
+    clock_gettime( CLOCK_MONOTONIC, &t );
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static void timer_init( struct bench_timer* timer, const char* name, long capacity )
+{
+    timer->name     = name;
+    timer->count    = 0;
+    timer->capacity = capacity > 0 ? capacity : 1;
+    timer->samples  = malloc( timer->capacity * sizeof(long) );
+    timer->total    = 0;
+    if( timer->samples == NULL )
+    {
+        fprintf( stderr, "Failed to allocate memory for %ld samples\n", capacity );
+        exit( -1 );
+    }
+}
+
+static void timer_add( struct bench_timer* timer, double start, double end )
+{
+    timer->total += end - start;
+    if( timer->count < timer->capacity )
+    {
+        timer->samples[timer->count++] = (long)( ( end - start ) * 1e9 );
+    }
+}
+
+static int compare_long( const void* a, const void* b )
+{
+    long x = *(const long*)a;
+    long y = *(const long*)b;
+    return ( x > y ) - ( x < y );
+}
+
+/* Print one result line and release the samples. The format is
+ * described in main().
+ */
+static void timer_report( struct bench_timer* timer )
+{
+    long p50 = 0, p99 = 0, max = 0;
+    if( timer->count > 0 )
+    {
+        qsort( timer->samples, timer->count, sizeof(long), compare_long );
+        p50 = timer->samples[( timer->count - 1 ) / 2];
+        p99 = timer->samples[( timer->count - 1 ) * 99 / 100];
+        max = timer->samples[timer->count - 1];
+    }
+    printf( "%s,%ld,%.6f,%.1f,%ld,%ld,%ld\n",
+            timer->name, timer->count, timer->total,
+            timer->total > 0 ? timer->count / timer->total : 0.0,
+            p50, p99, max );
+    fflush( stdout );
+    free( timer->samples );
+}
+
+static int random_size( const struct bench_config* config )
+{
+    double u = ( rand( ) + 1.0 ) / ( RAND_MAX + 2.0 );
+    switch( config->size_dist )
+    {
+    case SIZES_UNIFORM :
+        return (int)( u * 2 * config->size_mean );
+    case SIZES_EXPONENTIAL :
+        {
+            double size = -config->size_mean * log( u );
+            return size > 1 << 28 ? 1 << 28 : (int)size;
+        }
+    default :
+        return config->size_mean;
+    }
+}
+
+static void usage( const char* prog )
+{
+    fprintf( stderr, "This program builds a synthetic tree on a simulated disk and measures\n"
+                     "the throughput and latency of the inode and allocation functions.\n"
+                     "\n"
+                     "Usage: %s [options]\n"
+                     "       -n inodes      number of inodes in the tree (100000)\n"
+                     "       -f fanout      subdirectories per directory (8)\n"
+                     "       -d depth       levels of directories below the root (3)\n"
+                     "       -s bytes       mean file size (8192)\n"
+                     "       -D dist        file sizes: fixed, uniform or exponential (exponential)\n"
+                     "       -m mode        block allocation table: sync, cached, mmap or concurrent (cached)\n"
+                     "       -i iterations  repetitions of save_inodes and load_inodes (3)\n"
+                     "       -a blocks      number of allocate_block calls (20000)\n"
+                     "       -r seed        seed of the random numbers (1)\n"
+                     "       -o dir         directory for the table files (.)\n"
+                     , prog );
+    exit( -1 );
+}
+
+static void parse_options( int argc, char* argv[], struct bench_config* config )
+{
+    int opt;
+    while( ( opt = getopt( argc, argv, "n:f:d:s:D:m:i:a:r:o:" ) ) != -1 )
+    {
+        switch( opt )
+        {
+        case 'n' : config->num_inodes      = atoi( optarg ); break;
+        case 'f' : config->fanout          = atoi( optarg ); break;
+        case 'd' : config->depth           = atoi( optarg ); break;
+        case 's' : config->size_mean       = atoi( optarg ); break;
+        case 'i' : config->iterations      = atoi( optarg ); break;
+        case 'a' : config->num_allocations = atoi( optarg ); break;
+        case 'r' : config->seed            = (unsigned)atoi( optarg ); break;
+        case 'o' : config->dir             = optarg; break;
+        case 'D' :
+            if(      strcmp( optarg, "fixed" ) == 0 )       config->size_dist = SIZES_FIXED;
+            else if( strcmp( optarg, "uniform" ) == 0 )     config->size_dist = SIZES_UNIFORM;
+            else if( strcmp( optarg, "exponential" ) == 0 ) config->size_dist = SIZES_EXPONENTIAL;
+            else usage( argv[0] );
+            break;
+        case 'm' :
+            if(      strcmp( optarg, "sync" ) == 0 )   config->bat_mode = BAT_MODE_SYNCHRONOUS;
+            else if( strcmp( optarg, "cached" ) == 0 ) config->bat_mode = BAT_MODE_CACHED;
+            else if( strcmp( optarg, "mmap" ) == 0 )   config->bat_mode = BAT_MODE_MMAP;
+            else if( strcmp( optarg, "concurrent" ) == 0 ) config->bat_mode = BAT_MODE_CONCURRENT;
+            else usage( argv[0] );
+            break;
+        default :
+            usage( argv[0] );
+        }
+    }
+    if( optind != argc || config->num_inodes < 1 || config->fanout < 1 || config->depth < 0 ||
+        config->size_mean < 0 || config->iterations < 1 || config->num_allocations < 0 )
+    {
+        usage( argv[0] );
+    }
+}
+
+int main( int argc, char* argv[] )
+{
+    struct bench_config config = { 100000, 8, 3, 8192, SIZES_EXPONENTIAL,
+                                   BAT_MODE_CACHED, 3, 20000, 1, "." };
+    parse_options( argc, argv, &config );
+    srand( config.seed );
+
+    char mft_name[4096];
+    char bat_name[4096];
+    snprintf( mft_name, sizeof(mft_name), "%s/bench_master_file_table", config.dir );
+    snprintf( bat_name, sizeof(bat_name), "%s/bench_block_allocation_table", config.dir );
+
+    /* Plan the directories level by level; dirs[0] is the root. */
+    struct inode** dirs     = malloc( config.num_inodes * sizeof(struct inode*) );
+    int*           parents  = malloc( config.num_inodes * sizeof(int) );
+    int            num_dirs = 1;
+    int            level_lo = 0, level_hi = 1;
+    if( dirs == NULL || parents == NULL )
+    {
+        fprintf( stderr, "The tree is too large\n" );
+        exit( -1 );
+    }
+    parents[0] = -1;
+    for( int level = 0; level < config.depth && num_dirs < config.num_inodes; level++ )
+    {
+        for( int p = level_lo; p < level_hi; p++ )
+        {
+            for( int k = 0; k < config.fanout && num_dirs < config.num_inodes; k++ )
+            {
+                parents[num_dirs++] = p;
+            }
+        }
+        level_lo = level_hi;
+        level_hi = num_dirs;
+    }
+
+    /* Plan the files and size the disk for them, with room to spare
+     * for the allocate_block benchmark.
+     */
+    int   num_files = config.num_inodes - num_dirs;
+    int*  sizes     = malloc( ( num_files ? num_files : 1 ) * sizeof(int) );
+    long  blocks    = config.num_allocations + 64;
+    if( sizes == NULL )
+    {
+        fprintf( stderr, "The tree is too large\n" );
+        exit( -1 );
+    }
+    for( int i = 0; i < num_files; i++ )
+    {
+        sizes[i] = random_size( &config );
+        blocks  += sizes[i] / BLOCKSIZE + 1;
+    }
+    if( blocks > 1L << 30 )
+    {
+        fprintf( stderr, "The tree is too large\n" );
+        exit( -1 );
+    }
+
+    set_block_allocation_table_mode( config.bat_mode );
+    set_block_allocation_table_flush_threshold( 0 );
+    set_block_allocation_table_name( bat_name );
+    set_disk_size( (int)blocks );
+    if( format_disk( ) != 0 )
+    {
+        fprintf( stderr, "Failed to format the disk %s\n", bat_name );
+        exit( -1 );
+    }
+
+    /* One line per benchmark: name, number of operations, total
+     * seconds, operations per second, and the median, 99th percentile
+     * and maximum latency in nanoseconds.
+     */
+    printf( "# inodes=%d dirs=%d files=%d fanout=%d depth=%d size_mean=%d blocks=%ld\n",
+            config.num_inodes, num_dirs, num_files, config.fanout, config.depth,
+            config.size_mean, blocks );
+    printf( "benchmark,operations,seconds,ops_per_sec,p50_ns,p99_ns,max_ns\n" );
+
+    struct bench_timer timer;
+    char               name[32];
+    double             start;
+
+    timer_init( &timer, "create_dir", num_dirs );
+    for( int i = 0; i < num_dirs; i++ )
+    {
+        snprintf( name, sizeof(name), "d%d", i );
+        start   = now_seconds( );
+        dirs[i] = create_dir( i ? dirs[parents[i]] : NULL, name );
+        timer_add( &timer, start, now_seconds( ) );
+        if( dirs[i] == NULL )
+        {
+            fprintf( stderr, "create_dir failed\n" );
+            exit( -1 );
+        }
+    }
+    timer_report( &timer );
+    struct inode* root = dirs[0];
+
+    /* Files go to the directories in turn. */
+    struct inode** files        = malloc( ( num_files ? num_files : 1 ) * sizeof(struct inode*) );
+    int*           file_parents = malloc( ( num_files ? num_files : 1 ) * sizeof(int) );
+    if( files == NULL || file_parents == NULL )
+    {
+        fprintf( stderr, "The tree is too large\n" );
+        exit( -1 );
+    }
+    timer_init( &timer, "create_file", num_files );
+    for( int i = 0; i < num_files; i++ )
+    {
+        snprintf( name, sizeof(name), "f%d", i );
+        file_parents[i] = i % num_dirs;
+        start    = now_seconds( );
+        files[i] = create_file( dirs[file_parents[i]], name, sizes[i] );
+        timer_add( &timer, start, now_seconds( ) );
+        if( files[i] == NULL )
+        {
+            fprintf( stderr, "create_file failed\n" );
+            exit( -1 );
+        }
+    }
+    timer_report( &timer );
+    flush_block_allocation_table( );
+
+    timer_init( &timer, "find_inode_by_name", num_files );
+    for( int i = 0; i < num_files; i++ )
+    {
+        int k = rand( ) % num_files;
+        start = now_seconds( );
+        struct inode* found = find_inode_by_name( dirs[file_parents[k]], files[k]->name );
+        timer_add( &timer, start, now_seconds( ) );
+        if( found != files[k] )
+        {
+            fprintf( stderr, "find_inode_by_name returned the wrong inode\n" );
+            exit( -1 );
+        }
+    }
+    timer_report( &timer );
+
+    timer_init( &timer, "save_inodes", config.iterations );
+    for( int i = 0; i < config.iterations; i++ )
+    {
+        start = now_seconds( );
+        save_inodes( mft_name, root );
+        timer_add( &timer, start, now_seconds( ) );
+    }
+    timer_report( &timer );
+
+    timer_init( &timer, "load_inodes", config.iterations );
+    for( int i = 0; i < config.iterations; i++ )
+    {
+        start = now_seconds( );
+        struct inode* loaded = load_inodes( mft_name );
+        timer_add( &timer, start, now_seconds( ) );
+        if( loaded == NULL )
+        {
+            fprintf( stderr, "load_inodes failed\n" );
+            exit( -1 );
+        }
+        fs_shutdown( loaded );
+    }
+    timer_report( &timer );
+
+    /* Delete the files in random order. */
+    for( int i = num_files - 1; i > 0; i-- )
+    {
+        int k = rand( ) % ( i + 1 );
+        struct inode* f = files[i];
+        int           p = file_parents[i];
+        files[i] = files[k];        file_parents[i] = file_parents[k];
+        files[k] = f;               file_parents[k] = p;
+    }
+    timer_init( &timer, "delete_file", num_files );
+    for( int i = 0; i < num_files; i++ )
+    {
+        start = now_seconds( );
+        delete_file( dirs[file_parents[i]], files[i] );
+        timer_add( &timer, start, now_seconds( ) );
+    }
+    timer_report( &timer );
+    flush_block_allocation_table( );
+
+    size_t* allocated = malloc( ( config.num_allocations ? config.num_allocations : 1 ) * sizeof(size_t) );
+    int     num_allocated = 0;
+    timer_init( &timer, "allocate_block", config.num_allocations );
+    for( int i = 0; i < config.num_allocations; i++ )
+    {
+        start = now_seconds( );
+        int block = allocate_block( );
+        timer_add( &timer, start, now_seconds( ) );
+        if( block >= 0 ) allocated[num_allocated++] = block;
+    }
+    timer_report( &timer );
+    free_blocks( num_allocated, allocated );
+
+    fs_shutdown( root );
+    release_block_allocation_table_name( );
+    unlink( mft_name );
+    unlink( bat_name );
+
+    free( allocated );
+    free( files );
+    free( file_parents );
+    free( sizes );
+    free( parents );
+    free( dirs );
+    return 0;
+}
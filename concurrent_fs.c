@@ -0,0 +1,224 @@
+#include "inode.h"
+#include "allocation.h"
+
+#include <stdio.h>
+#include <pthread.h>
+
+#define NUM_THREADS      4
+#define FILES_PER_THREAD 300
+
+/* The arguments of one creating and deleting thread.
+ */
+struct worker
+{
+    int           index;
+    struct inode* root;
+    struct inode* shared;
+    int           lookup_misses;
+};
+
+/* Count the inodes that differ between two trees. Ids, names, sizes
+ * and blocks must all be the same.
+ */
+static int compare_trees( struct inode* a, struct inode* b )
+{
+    if( a == NULL || b == NULL ) return !( a == NULL && b == NULL );
+
+    if( a->id != b->id || strcmp( a->name, b->name ) != 0 ||
+        a->is_directory != b->is_directory )
+        return 1;
+
+    if( !a->is_directory )
+    {
+        if( a->filesize != b->filesize || a->num_blocks != b->num_blocks ) return 1;
+
+        struct block_iterator it_a;
+        struct block_iterator it_b;
+        size_t block_a;
+        size_t block_b;
+        block_iterator_init( &it_a, a );
+        block_iterator_init( &it_b, b );
+        while( block_iterator_next( &it_a, &block_a ) )
+        {
+            if( !block_iterator_next( &it_b, &block_b ) || block_a != block_b ) return 1;
+        }
+        return 0;
+    }
+
+    if( a->num_children != b->num_children ) return 1;
+
+    int differences = 0;
+    for( int i = 0; i < a->num_children; i++ )
+    {
+        differences += compare_trees( a->children[i], b->children[i] );
+    }
+    return differences;
+}
+
+/* Count the inodes below node, mark their ids in seen and add up the
+ * blocks of the files. duplicates counts ids that were seen before.
+ */
+static int walk( struct inode* node, char* seen, int max_id, int* duplicates, int* blocks )
+{
+    if( node->id < 0 || node->id >= max_id || seen[node->id] ) (*duplicates)++;
+    else                                                      seen[node->id] = 1;
+
+    if( !node->is_directory )
+    {
+        *blocks += node->num_blocks;
+        return 1;
+    }
+
+    int count = 1;
+    for( int i = 0; i < node->num_children; i++ )
+    {
+        count += walk( node->children[i], seen, max_id, duplicates, blocks );
+    }
+    return count;
+}
+
+/* Count the blocks that are marked as used in the block allocation
+ * table file.
+ */
+static int used_blocks_in_file( char* name )
+{
+    FILE* file = fopen( name, "rb" );
+    int   used = 0;
+    int   c;
+    if( file == NULL ) return -1;
+    while( ( c = fgetc( file ) ) != EOF )
+    {
+        if( c ) used++;
+    }
+    fclose( file );
+    return used;
+}
+
+/* Create a directory of its own below the root and fill it, create
+ * files in the shared directory next to those of the other threads,
+ * look all of them up and delete every third file in the shared
+ * directory again.
+ */
+static void* worker_thread( void* arg )
+{
+    struct worker* w = arg;
+    struct inode*  created[FILES_PER_THREAD];
+    char           name[32];
+    char           path[64];
+
+    snprintf( name, sizeof(name), "t%d", w->index );
+    struct inode* own = create_dir( w->root, name );
+
+    for( int i = 0; i < FILES_PER_THREAD; i++ )
+    {
+        snprintf( name, sizeof(name), "f%d", i );
+        create_file( own, name, 100 + i );
+        snprintf( name, sizeof(name), "t%d_f%d", w->index, i );
+        created[i] = create_file( w->shared, name, 100 + i );
+    }
+
+    for( int i = 0; i < FILES_PER_THREAD; i++ )
+    {
+        snprintf( path, sizeof(path), "/t%d/f%d", w->index, i );
+        if( lookup_path( w->root, path ) == NULL ) w->lookup_misses++;
+        snprintf( name, sizeof(name), "t%d_f%d", w->index, i );
+        if( find_inode_by_name( w->shared, name ) != created[i] ) w->lookup_misses++;
+    }
+
+    for( int i = 0; i < FILES_PER_THREAD; i += 3 )
+    {
+        delete_file( w->shared, created[i] );
+    }
+    return NULL;
+}
+
+int main( int argc, char* argv[] )
+{
+    if( argc != 3 )
+    {
+        fprintf( stderr, "This program lets several threads create, look up and delete files at once\n"
+                         "in the concurrent mode of set_inode_concurrency(), each in a directory of\n"
+                         "its own and all of them in a shared directory. Then it checks the number\n"
+                         "of inodes, the paths that must be there or gone, that no id was given out\n"
+                         "twice, and that the used blocks match the files. Finally, the tree is saved\n"
+                         "to the master file table (MFT), loaded again and compared.\n"
+                         "\n"
+                         "Usage: %s MFT BAT\n"
+                         "       where\n"
+                         "       MFT is the name of the master file table\n"
+                         "       BAT is the name of the block allocation table\n"
+                         , argv[0] );
+        exit( -1 );
+    }
+
+    char* mft_name = argv[1];
+    char* bat_name = argv[2];
+    char  path[64];
+
+    set_block_allocation_table_mode( BAT_MODE_CONCURRENT );
+    set_disk_size( 16384 );
+    set_block_allocation_table_name( bat_name );
+    format_disk();
+    set_inode_concurrency( 1 );
+
+    struct inode* root   = create_dir( NULL, "/" );
+    struct inode* shared = create_dir( root, "shared" );
+
+    struct worker workers[NUM_THREADS];
+    pthread_t     threads[NUM_THREADS];
+    for( int t = 0; t < NUM_THREADS; t++ )
+    {
+        workers[t].index         = t;
+        workers[t].root          = root;
+        workers[t].shared        = shared;
+        workers[t].lookup_misses = 0;
+        pthread_create( &threads[t], NULL, worker_thread, &workers[t] );
+    }
+    int misses = 0;
+    for( int t = 0; t < NUM_THREADS; t++ )
+    {
+        pthread_join( threads[t], NULL );
+        misses += workers[t].lookup_misses;
+    }
+    set_inode_concurrency( 0 );
+    printf("Lookups during the run that missed: %d\n", misses );
+
+    int present = 0;
+    int deleted = 0;
+    for( int t = 0; t < NUM_THREADS; t++ )
+    {
+        for( int i = 0; i < FILES_PER_THREAD; i++ )
+        {
+            snprintf( path, sizeof(path), "/t%d/f%d", t, i );
+            if( lookup_path( root, path ) ) present++;
+            snprintf( path, sizeof(path), "/shared/t%d_f%d", t, i );
+            if( lookup_path( root, path ) ) present++;
+            else if( i % 3 == 0 ) deleted++;
+        }
+    }
+    printf("Files found: %d, deleted files gone: %d\n", present, deleted );
+
+    int   max_id     = 2 + NUM_THREADS * ( 1 + 2 * FILES_PER_THREAD );
+    char* seen       = calloc( max_id, 1 );
+    int   duplicates = 0;
+    int   blocks     = 0;
+    if( seen == NULL )
+    {
+        fprintf( stderr, "Memory allocation failed\n" );
+        exit( -1 );
+    }
+    int count = walk( root, seen, max_id, &duplicates, &blocks );
+    free( seen );
+    flush_block_allocation_table( );
+    printf("Inodes: %d, %d in /shared, duplicate ids: %d\n", count, shared->num_children, duplicates );
+    printf("Blocks of the files: %d, used blocks in the table: %d\n", blocks, used_blocks_in_file( bat_name ) );
+
+    save_inodes( mft_name, root );
+    struct inode* loaded = load_inodes( mft_name );
+    printf("Saved and loaded again: %d inodes differ\n", compare_trees( root, loaded ) );
+    if( loaded ) fs_shutdown( loaded );
+
+    fs_shutdown( root );
+    release_block_allocation_table_name( );
+    set_block_allocation_table_mode( BAT_MODE_SYNCHRONOUS );
+}
@@ -0,0 +1,149 @@
+#include "inode.h"
+#include "allocation.h"
+
+#include <stdio.h>
+
+static const char* paths[] =
+{
+    "/usr",
+    "/usr/bin/ls",
+    "/usr/local",
+    "/usr/local/bin/gcc",
+    "/usr/local/share",
+    "/etc/hosts",
+    NULL
+};
+
+/* Count the inodes that differ between two trees. Ids, names, sizes
+ * and blocks must all be the same.
+ */
+static int compare_trees( struct inode* a, struct inode* b )
+{
+    if( a == NULL || b == NULL ) return !( a == NULL && b == NULL );
+
+    if( a->id != b->id || strcmp( a->name, b->name ) != 0 ||
+        a->is_directory != b->is_directory )
+        return 1;
+
+    if( !a->is_directory )
+    {
+        if( a->filesize != b->filesize || a->num_blocks != b->num_blocks ) return 1;
+
+        struct block_iterator it_a;
+        struct block_iterator it_b;
+        size_t block_a;
+        size_t block_b;
+        block_iterator_init( &it_a, a );
+        block_iterator_init( &it_b, b );
+        while( block_iterator_next( &it_a, &block_a ) )
+        {
+            if( !block_iterator_next( &it_b, &block_b ) || block_a != block_b ) return 1;
+        }
+        return 0;
+    }
+
+    if( a->num_children != b->num_children ) return 1;
+
+    int differences = 0;
+    for( int i = 0; i < a->num_children; i++ )
+    {
+        differences += compare_trees( a->children[i], b->children[i] );
+    }
+    return differences;
+}
+
+/* Count the blocks that are marked as used in the block allocation
+ * table file.
+ */
+static int used_blocks_in_file( char* name )
+{
+    FILE* file = fopen( name, "rb" );
+    int   used = 0;
+    int   c;
+    if( file == NULL ) return -1;
+    while( ( c = fgetc( file ) ) != EOF )
+    {
+        if( c ) used++;
+    }
+    fclose( file );
+    return used;
+}
+
+/* Print which of the paths are still there and how many blocks are
+ * used.
+ */
+static void print_state( struct inode* root, char* bat_name )
+{
+    for( int i = 0; paths[i]; i++ )
+    {
+        printf("  %-20s %s\n", paths[i], lookup_path( root, paths[i] ) ? "there" : "missing" );
+    }
+    printf("  Used blocks: %d\n", used_blocks_in_file( bat_name ) );
+}
+
+int main( int argc, char* argv[] )
+{
+    if( argc != 4 )
+    {
+        fprintf( stderr, "This program creates a small file system, saves it to the master file\n"
+                         "table (MFT) and removes a directory with everything below it using\n"
+                         "delete_tree(), with a journal set. After each step, it shows which paths\n"
+                         "are left and how many blocks are used. The MFT is loaded at the end,\n"
+                         "which replays the deletions from the journal, and the loaded tree is\n"
+                         "compared with the tree in memory.\n"
+                         "\n"
+                         "Usage: %s MFT BAT JOURNAL\n"
+                         "       where\n"
+                         "       MFT is the name of the master file table\n"
+                         "       BAT is the name of the block allocation table\n"
+                         "       JOURNAL is the name of the journal\n"
+                         , argv[0] );
+        exit( -1 );
+    }
+
+    char* mft_name     = argv[1];
+    char* bat_name     = argv[2];
+    char* journal_name = argv[3];
+
+    set_block_allocation_table_name( bat_name );
+    set_disk_size( 50 );
+    format_disk();
+    remove( journal_name );
+
+    struct inode* root      = create_dir( NULL, "/" );
+    struct inode* dir_etc   = create_dir( root, "etc" );
+    struct inode* dir_usr   = create_dir( root, "usr" );
+    struct inode* dir_bin   = create_dir( dir_usr, "bin" );
+    struct inode* dir_local = create_dir( dir_usr, "local" );
+    struct inode* dir_lbin  = create_dir( dir_local, "bin" );
+    create_dir( dir_local, "share" );
+    create_file( root, "kernel", 20000 );
+    create_file( dir_etc, "hosts", 200 );
+    create_file( dir_bin, "ls", 14322 );
+    create_file( dir_bin, "ps", 9000 );
+    create_file( dir_lbin, "gcc", 12623 );
+    create_file( dir_lbin, "clang", 8000 );
+    save_inodes( mft_name, root );
+    set_journal_name( journal_name );
+    printf("Before deleting:\n");
+    print_state( root, bat_name );
+
+    printf("delete_tree of /usr/local returned %d\n", delete_tree( dir_usr, dir_local ) );
+    print_state( root, bat_name );
+
+    /* A file may be deleted with delete_tree(), too, but only below
+     * its own parent.
+     */
+    printf("delete_tree of /usr/bin below / returned %d\n", delete_tree( root, dir_bin ) );
+    printf("delete_tree of /etc/hosts returned %d\n",
+           delete_tree( dir_etc, lookup_path( root, "/etc/hosts" ) ) );
+    print_state( root, bat_name );
+
+    struct inode* loaded = load_inodes( mft_name );
+    printf("Replayed from the journal: %d inodes differ\n", compare_trees( root, loaded ) );
+    if( loaded ) fs_shutdown( loaded );
+
+    set_journal_name( NULL );
+    fs_shutdown( root );
+    release_block_allocation_table_name( );
+}
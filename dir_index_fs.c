@@ -0,0 +1,98 @@
+#include "inode.h"
+#include "allocation.h"
+
+#include <stdio.h>
+
+/* The search that find_inode_by_name() does without an index: the
+ * first child with the name.
+ */
+static struct inode* linear_find( struct inode* dir, char* name )
+{
+    for( int i = 0; i < dir->num_children; i++ )
+    {
+        if( strcmp( dir->children[i]->name, name ) == 0 ) return dir->children[i];
+    }
+    return NULL;
+}
+
+/* Look up f0 to f299 and a name that never exists in dir, and count
+ * the lookups whose result differs from linear_find().
+ */
+static void check( const char* what, struct inode* dir )
+{
+    char name[32];
+    int  found       = 0;
+    int  differences = 0;
+    for( int i = 0; i <= 300; i++ )
+    {
+        if( i < 300 ) snprintf( name, sizeof(name), "f%d", i );
+        else          snprintf( name, sizeof(name), "missing" );
+
+        struct inode* node = find_inode_by_name( dir, name );
+        if( node != linear_find( dir, name ) ) differences++;
+        if( node ) found++;
+    }
+    printf("%-26s %3d children, %3d names found, %d differ from a linear search\n",
+           what, dir->num_children, found, differences );
+}
+
+int main( int argc, char* argv[] )
+{
+    if( argc != 2 )
+    {
+        fprintf( stderr, "This program creates a directory with a few hundred files and looks up\n"
+                         "names in it through find_inode_by_name(), which uses a hash index for\n"
+                         "large directories. Every result is compared with a linear search of the\n"
+                         "children, after creating, deleting and adding files with duplicate names.\n"
+                         "\n"
+                         "Usage: %s BAT\n"
+                         "       where\n"
+                         "       BAT is the name of the block allocation table\n"
+                         , argv[0] );
+        exit( -1 );
+    }
+
+    char name[32];
+
+    set_block_allocation_table_name( argv[1] );
+    set_disk_size( 400 );
+    format_disk();
+
+    struct inode* root  = create_dir( NULL, "/" );
+    struct inode* small = create_dir( root, "small" );
+    struct inode* large = create_dir( root, "large" );
+    for( int i = 0; i < 10; i++ )
+    {
+        snprintf( name, sizeof(name), "f%d", i );
+        create_file( small, name, 100 );
+    }
+    for( int i = 0; i < 250; i++ )
+    {
+        snprintf( name, sizeof(name), "f%d", i );
+        create_file( large, name, 100 );
+    }
+    check( "small directory", small );
+    check( "large directory", large );
+
+    for( int i = 0; i < 100; i += 2 )
+    {
+        snprintf( name, sizeof(name), "f%d", i );
+        delete_file( large, find_inode_by_name( large, name ) );
+    }
+    check( "after deleting 50 files", large );
+
+    /* With duplicate names, the first child is found.
+     */
+    struct inode* first = find_inode_by_name( large, "f99" );
+    struct inode* dup   = create_file( large, "f99", 100 );
+    create_file( large, "f260", 100 );
+    check( "after adding a duplicate", large );
+    printf("f99 finds the %s file\n", find_inode_by_name( large, "f99" ) == first ? "first" : "second" );
+
+    delete_file( large, first );
+    check( "after deleting the first", large );
+    printf("f99 finds the %s file\n", find_inode_by_name( large, "f99" ) == dup ? "second" : "wrong" );
+
+    fs_shutdown( root );
+    release_block_allocation_table_name( );
+}
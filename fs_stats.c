@@ -0,0 +1,170 @@
+#include "fs_stats.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+static const char* op_names[FS_NUM_OPS] =
+{
+    "allocate_block",
+    "allocate_blocks",
+    "free_block",
+    "free_blocks",
+    "create_file",
+    "create_dir",
+    "delete_file",
+    "delete_dir",
+    "delete_tree",
+    "find_inode_by_name",
+    "lookup_path",
+    "load_inodes",
+    "save_inodes",
+    "update_inodes"
+};
+
+const char* fs_op_name( int op )
+{
+    if( op < 0 || op >= FS_NUM_OPS ) return "unknown";
+    return op_names[op];
+}
+
+#ifndef FS_NO_STATS
+
+/* Bucket b of a histogram counts latencies from 2^b to 2^(b+1)-1
+ * nanoseconds; bucket 0 also counts 0.
+ */
+#define FS_STATS_BUCKETS 64
+
+long fs_counters[FS_NUM_COUNTERS];
+
+static long histograms[FS_NUM_OPS][FS_STATS_BUCKETS];
+static long totals[FS_NUM_OPS];
+static long maxima[FS_NUM_OPS];
+
+static long now_ns( )
+{
+    struct timespec t;
+    clock_gettime( CLOCK_MONOTONIC, &t );
+    return t.tv_sec * 1000000000L + t.tv_nsec;
+}
+
+struct fs_stats_timer fs_stats_start( int op )
+{
+    struct fs_stats_timer timer = { op, now_ns( ) };
+    return timer;
+}
+
+void fs_stats_stop( struct fs_stats_timer* timer )
+{
+    long ns     = now_ns( ) - timer->start;
+    int  bucket = ns > 1 ? 63 - __builtin_clzl( (unsigned long)ns ) : 0;
+
+    __atomic_fetch_add( &histograms[timer->op][bucket], 1, __ATOMIC_RELAXED );
+    __atomic_fetch_add( &totals[timer->op], ns, __ATOMIC_RELAXED );
+
+    long max = __atomic_load_n( &maxima[timer->op], __ATOMIC_RELAXED );
+    while( ns > max &&
+           !__atomic_compare_exchange_n( &maxima[timer->op], &max, ns, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED ) )
+    {
+    }
+}
+
+/* Estimate the latency below which a share of fraction of the count
+ * samples in histogram fall. The samples of a bucket are taken to be
+ * spread evenly over it.
+ */
+static long percentile( const long* histogram, long count, long max, double fraction )
+{
+    double rank = fraction * count;
+    long   seen = 0;
+    for( int b = 0; b < FS_STATS_BUCKETS; b++ )
+    {
+        if( histogram[b] == 0 ) continue;
+        if( seen + histogram[b] >= rank )
+        {
+            double lo    = b ? (double)( 1L << b ) : 0;
+            double hi    = b < 62 ? (double)( 1L << ( b + 1 ) ) : (double)max;
+            long   value = (long)( lo + ( hi - lo ) * ( rank - seen ) / histogram[b] );
+            return value < max ? value : max;
+        }
+        seen += histogram[b];
+    }
+    return max;
+}
+
+void fs_get_stats( struct fs_stats* stats )
+{
+    long counters[FS_NUM_COUNTERS];
+    for( int c = 0; c < FS_NUM_COUNTERS; c++ )
+    {
+        counters[c] = __atomic_load_n( &fs_counters[c], __ATOMIC_RELAXED );
+    }
+    stats->bat_opens         = counters[FS_COUNT_BAT_OPENS];
+    stats->bat_reads         = counters[FS_COUNT_BAT_READS];
+    stats->bat_bytes_read    = counters[FS_COUNT_BAT_BYTES_READ];
+    stats->bat_writes        = counters[FS_COUNT_BAT_WRITES];
+    stats->bat_bytes_written = counters[FS_COUNT_BAT_BYTES_WRITTEN];
+    stats->mft_bytes_read    = counters[FS_COUNT_MFT_BYTES_READ];
+    stats->mft_bytes_written = counters[FS_COUNT_MFT_BYTES_WRITTEN];
+    stats->inode_mallocs     = counters[FS_COUNT_INODE_MALLOCS];
+
+    for( int op = 0; op < FS_NUM_OPS; op++ )
+    {
+        long histogram[FS_STATS_BUCKETS];
+        long count = 0;
+        for( int b = 0; b < FS_STATS_BUCKETS; b++ )
+        {
+            histogram[b] = __atomic_load_n( &histograms[op][b], __ATOMIC_RELAXED );
+            count       += histogram[b];
+        }
+
+        struct fs_latency* latency = &stats->ops[op];
+        latency->count    = count;
+        latency->total_ns = __atomic_load_n( &totals[op], __ATOMIC_RELAXED );
+        latency->max_ns   = __atomic_load_n( &maxima[op], __ATOMIC_RELAXED );
+        latency->p50_ns   = percentile( histogram, count, latency->max_ns, 0.50 );
+        latency->p99_ns   = percentile( histogram, count, latency->max_ns, 0.99 );
+    }
+}
+
+void fs_reset_stats( )
+{
+    memset( fs_counters, 0, sizeof(fs_counters) );
+    memset( histograms, 0, sizeof(histograms) );
+    memset( totals, 0, sizeof(totals) );
+    memset( maxima, 0, sizeof(maxima) );
+}
+
+#else
+
+void fs_get_stats( struct fs_stats* stats )
+{
+    memset( stats, 0, sizeof(struct fs_stats) );
+}
+
+void fs_reset_stats( )
+{
+}
+
+#endif
+
+void fs_print_stats( FILE* out )
+{
+    struct fs_stats stats;
+    fs_get_stats( &stats );
+
+    fprintf( out, "bat_opens %ld\n", stats.bat_opens );
+    fprintf( out, "bat_reads %ld (%ld bytes)\n", stats.bat_reads, stats.bat_bytes_read );
+    fprintf( out, "bat_writes %ld (%ld bytes)\n", stats.bat_writes, stats.bat_bytes_written );
+    fprintf( out, "mft_bytes_read %ld\n", stats.mft_bytes_read );
+    fprintf( out, "mft_bytes_written %ld\n", stats.mft_bytes_written );
+    fprintf( out, "inode_mallocs %ld\n", stats.inode_mallocs );
+    for( int op = 0; op < FS_NUM_OPS; op++ )
+    {
+        const struct fs_latency* latency = &stats.ops[op];
+        if( latency->count == 0 ) continue;
+        fprintf( out, "%s count %ld total %ldns p50 %ldns p99 %ldns max %ldns\n",
+                 fs_op_name( op ), latency->count, latency->total_ns,
+                 latency->p50_ns, latency->p99_ns, latency->max_ns );
+    }
+}
@@ -0,0 +1,124 @@
+#ifndef FS_STATS_H
+#define FS_STATS_H
+
+#include <stdio.h>
+
+/* Operations whose latency is recorded. Nested operations are
+ * recorded as well; a create_file() also records the
+ * allocate_blocks() call it makes.
+ */
+#define FS_OP_ALLOCATE_BLOCK      0
+#define FS_OP_ALLOCATE_BLOCKS     1
+#define FS_OP_FREE_BLOCK          2
+#define FS_OP_FREE_BLOCKS         3
+#define FS_OP_CREATE_FILE         4
+#define FS_OP_CREATE_DIR          5
+#define FS_OP_DELETE_FILE         6
+#define FS_OP_DELETE_DIR          7
+#define FS_OP_DELETE_TREE         8
+#define FS_OP_FIND_INODE_BY_NAME  9
+#define FS_OP_LOOKUP_PATH        10
+#define FS_OP_LOAD_INODES        11
+#define FS_OP_SAVE_INODES        12
+#define FS_OP_UPDATE_INODES      13
+#define FS_NUM_OPS               14
+
+/* Latencies are kept in a histogram with one bucket per power of two
+ * nanoseconds. p50_ns and p99_ns are interpolated within their bucket,
+ * so they are estimates; count, total_ns and max_ns are exact.
+ */
+struct fs_latency
+{
+    long count;
+    long total_ns;
+    long p50_ns;
+    long p99_ns;
+    long max_ns;
+};
+
+/* Counters since the start of the program or the last
+ * fs_reset_stats().
+ * bat_opens counts every open of the block allocation table file,
+ * bat_reads and bat_writes the reads and writes of the file, and an
+ * msync() of the mapped table counts as a write of the whole file.
+ * The master file table counters include update_inodes(),
+ * checkpoint_inodes() and the journal.
+ * inode_mallocs counts the heap allocations of inode.c for inodes,
+ * names, block lists, child arrays and name indexes.
+ */
+struct fs_stats
+{
+    long bat_opens;
+    long bat_reads;
+    long bat_bytes_read;
+    long bat_writes;
+    long bat_bytes_written;
+    long mft_bytes_read;
+    long mft_bytes_written;
+    long inode_mallocs;
+
+    struct fs_latency ops[FS_NUM_OPS];
+};
+
+/* Copy the current counters into stats. If the library was built
+ * with -DFS_NO_STATS, all of them are 0.
+ */
+void fs_get_stats( struct fs_stats* stats );
+
+/* Set all counters and histograms back to 0.
+ */
+void fs_reset_stats( );
+
+/* Return the name of an FS_OP_ value, e.g. "create_file".
+ */
+const char* fs_op_name( int op );
+
+/* Print the counters and the operations that were used to out.
+ */
+void fs_print_stats( FILE* out );
+
+/* The hooks below are used by allocation.c and inode.c. Counters are
+ * updated with relaxed atomic additions, so that the threads of
+ * load_inodes() can count too, and a timed operation costs two reads
+ * of the monotonic clock. Building with -DFS_NO_STATS removes them.
+ */
+#define FS_COUNT_BAT_OPENS         0
+#define FS_COUNT_BAT_READS         1
+#define FS_COUNT_BAT_BYTES_READ    2
+#define FS_COUNT_BAT_WRITES        3
+#define FS_COUNT_BAT_BYTES_WRITTEN 4
+#define FS_COUNT_MFT_BYTES_READ    5
+#define FS_COUNT_MFT_BYTES_WRITTEN 6
+#define FS_COUNT_INODE_MALLOCS     7
+#define FS_NUM_COUNTERS            8
+
+#ifndef FS_NO_STATS
+
+extern long fs_counters[FS_NUM_COUNTERS];
+
+struct fs_stats_timer
+{
+    int  op;
+    long start;
+};
+
+struct fs_stats_timer fs_stats_start( int op );
+void                  fs_stats_stop( struct fs_stats_timer* timer );
+
+#define FS_STATS_COUNT( counter, n ) \
+    ( (void)__atomic_fetch_add( &fs_counters[counter], (long)( n ), __ATOMIC_RELAXED ) )
+
+/* Time the rest of the enclosing block as operation op, whichever
+ * way the block is left.
+ */
+#define FS_STATS_TIME( op ) \
+    struct fs_stats_timer fs_stats_timer_ __attribute__(( cleanup( fs_stats_stop ) )) = fs_stats_start( op )
+
+#else
+
+#define FS_STATS_COUNT( counter, n ) ( (void)0 )
+#define FS_STATS_TIME( op )          ( (void)0 )
+
+#endif
+
+#endif
@@ -1,23 +1,28 @@
 #include "allocation.h"
 #include "inode.h"
+#include "arena.h"
+#include "fs_stats.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
 #include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <unistd.h>
 #include <math.h> //for å avrunde - ceil()
 
 
-/* The number of bytes in a block.
- * Do not change.
- */
-#define BLOCKSIZE 4096
-
 /* The lowest unused node ID.
  * Do not change.
  */
 static int num_inode_ids = 0;
 
+/* How create_file() stores the blocks of new files.
+ */
+static int file_layout = FILE_LAYOUT_BLOCKS;
+
 /* This helper function computes the number of blocks that you must allocate
  * on the simulated disk for a give file system in bytes. You don't have to use
  * it.
@@ -39,523 +44,2820 @@ static int blocks_needed( int bytes )
  */
 static int next_inode_id( )
 {
-    int retval = num_inode_ids;
-    num_inode_ids += 1;
-    return retval;
+    return __atomic_fetch_add( &num_inode_ids, 1, __ATOMIC_RELAXED );
 }
 
-/* Create a file below the inode parent. Parent must
- * be a directory. The size of the file is size_in_bytes,
- * and create_file calls the allocate_block() function
- * enough number of times to reserve blocks in the simulated
- * disk to store all of these bytes.
- * Returns a pointer to file's inodes.
+/* Append records to the journal, if one is set. Defined below.
  */
-struct inode* create_file(struct inode* parent, char* name, int size_in_bytes) {
-    // Allocate memory for the new inode
-    struct inode* new_inode = (struct inode*)calloc(1, sizeof(struct inode));
-    if (new_inode == NULL) {
-        printf("Memory allocation failed\n");
-        return NULL;
+static void journal_create( struct inode* parent, struct inode* node );
+static void journal_delete( struct inode* parent, struct inode* node );
+static void journal_delete_tree( struct inode* parent, struct inode* node );
+static void journal_sync( );
+
+/* While journal_deferred is set, records are only buffered, and
+ * journal_sync() hands them to the operating system together.
+ */
+static int journal_deferred = 0;
+
+/* Inodes that are created while the arena mode is enabled come from
+ * inode_slabs, and their arrays from inode_arena. Such memory is never
+ * handed back to malloc one piece at a time; the arena and the slabs
+ * are destroyed as a whole when the last of their inodes is gone.
+ * The counter of live arena inodes tells when that is.
+ * live_heap_inodes counts the inodes from malloc, and live_roots the
+ * trees that create_dir() and load_inodes() handed out and
+ * fs_shutdown() has not released. When the last tree is released and
+ * no heap inode is left, all live inodes are arena inodes of that
+ * tree, and fs_shutdown() destroys the arena without visiting them.
+ * Inodes differ in size with their names and block lists, so there is
+ * one slab per multiple of INODE_SLAB_STEP bytes. in_arena is the
+ * number of the slab of an inode, or INODE_SLAB_CLASSES + 1 for a
+ * large inode that was taken from the arena and is not reused.
+ */
+#define INODE_ARENA_REGION_SIZE (1 << 20)
+#define INODE_SLAB_OBJECTS      4096
+#define INODE_SLAB_STEP         16
+#define INODE_SLAB_CLASSES      16
+
+static int           use_arena = 0;
+static struct arena* inode_arena = NULL;
+static struct slab*  inode_slabs[INODE_SLAB_CLASSES];
+static int           live_arena_inodes = 0;
+static int           live_heap_inodes  = 0;
+static int           live_roots        = 0;
+
+/* While concurrent is set, every directory is guarded by the rwlock
+ * in the lock field of its dir_extra, which is created the first time
+ * it is needed. The dentry cache and the change lists of
+ * update_inodes() are shared by all directories, so they are not
+ * used: lookups go to the directories, and dirty_overflow makes the
+ * next update_inodes() write the whole table. journal_lock keeps
+ * journal records whole.
+ */
+struct inode_lock
+{
+    pthread_rwlock_t rwlock;
+};
+
+static int             concurrent   = 0;
+static pthread_mutex_t journal_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void clear_changes( );
+static int  dirty_overflow;
+
+/* The parts of a directory that a file does not need. A directory
+ * with many children gets a hash index over the names of its children
+ * the first time find_inode_by_name() searches it. Otherwise, index is
+ * NULL. lock is the reader/writer lock of the directory in the
+ * concurrent mode, or NULL until it is first needed. They follow the
+ * name so that struct inode keeps a single pointer in place of the
+ * block list.
+ */
+struct dir_extra
+{
+    struct dir_index*  index;
+    struct inode_lock* lock;
+};
+
+static struct dir_extra* dir_extra( const struct inode* dir );
+
+void set_inode_arena( int enable )
+{
+    if( enable && concurrent )
+    {
+        fprintf( stderr, "The arena mode cannot be used in the concurrent mode\n" );
+        return;
     }
+    use_arena = enable;
+}
 
-    // Add the new file inode to the parent directory's list of children
-    parent->num_children++;
-    parent->children = (struct inode**)realloc(parent->children, parent->num_children * sizeof(struct inode*));
-    parent->children[parent->num_children - 1] = new_inode;
+int set_inode_concurrency( int enable )
+{
+    if( enable && ( use_arena || live_arena_inodes > 0 ) )
+    {
+        fprintf( stderr, "The concurrent mode cannot be used with arena inodes\n" );
+        return -1;
+    }
+    if( enable && !concurrent )
+    {
+        clear_changes( );
+        dirty_overflow = 1;
+    }
+    concurrent = enable;
+    dentry_cache_clear( );
+    return 0;
+}
 
-    // Set attributes for the new inode
-    new_inode->id = next_inode_id();
-    new_inode->name = strdup(name); // Allocate memory for the name and copy it
-    new_inode->is_directory = 0;
-    new_inode->num_children = 0;
-    new_inode->children = NULL;
-    new_inode->filesize = size_in_bytes;
-   // printf(" new_inode->filesize:  %d",  new_inode->filesize);
-    new_inode->num_blocks = (new_inode->filesize / BLOCKSIZE + 1);
-    new_inode->blocks = (size_t*)calloc(new_inode->num_blocks, sizeof(size_t));
-    if (new_inode->blocks == NULL) {
-        printf("Memory allocation failed\n");
-        free(new_inode->name);
-        free(new_inode);
+/* Return the lock of dir, creating it if necessary. Two threads may
+ * race to create it; the loser frees its copy. Returns NULL if memory
+ * runs out.
+ */
+static struct inode_lock* dir_lock( struct inode* dir )
+{
+    struct inode_lock* lock = __atomic_load_n( &dir_extra( dir )->lock, __ATOMIC_ACQUIRE );
+    if( lock ) return lock;
+
+    struct inode_lock* fresh = malloc( sizeof(struct inode_lock) );
+    if( fresh == NULL || pthread_rwlock_init( &fresh->rwlock, NULL ) != 0 )
+    {
+        fprintf( stderr, "Failed to create the lock of directory %s\n", dir->name );
+        free( fresh );
         return NULL;
     }
+    if( !__atomic_compare_exchange_n( &dir_extra( dir )->lock, &lock, fresh, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE ) )
+    {
+        pthread_rwlock_destroy( &fresh->rwlock );
+        free( fresh );
+        return lock;
+    }
+    return fresh;
+}
 
-    // Allocate blocks for the file using the allocate_block function
-    for (int i = 0; i < new_inode->num_blocks; i++) {
-        int block = allocate_block();
-        if (block == -1) {
-            // Error: Not enough space on the simulated disk
-            free(new_inode->blocks); // Free the allocated blocks
-            free(new_inode->name);
-            free(new_inode); // Free the new_file inode
-            printf("Error: Not enough space on the disk\n");
-            return NULL;
-        }
-        new_inode->blocks[i] = block;
+/* Lock dir for reading or writing in concurrent mode; do nothing
+ * otherwise. Returns 0 in case of success and -1 if the lock cannot
+ * be created.
+ */
+static int lock_dir( struct inode* dir, int write )
+{
+    if( !concurrent ) return 0;
+
+    struct inode_lock* lock = dir_lock( dir );
+    if( lock == NULL ) return -1;
+    if( write ) pthread_rwlock_wrlock( &lock->rwlock );
+    else        pthread_rwlock_rdlock( &lock->rwlock );
+    return 0;
+}
+
+static void unlock_dir( struct inode* dir )
+{
+    if( concurrent ) pthread_rwlock_unlock( &dir_extra( dir )->lock->rwlock );
+}
+
+/* The block list or the extents of a file, and the dir_extra of a
+ * directory, start at the first multiple of INODE_TAIL_ALIGN after the
+ * name.
+ */
+#define INODE_TAIL_ALIGN sizeof(size_t)
+
+/* The number of bytes of an inode with a name of len characters and
+ * tail_size bytes after it.
+ */
+static size_t inode_size( size_t len, size_t tail_size )
+{
+    size_t size = offsetof( struct inode, name ) + len + 1;
+    if( tail_size > 0 )
+        size = ( size + INODE_TAIL_ALIGN - 1 ) / INODE_TAIL_ALIGN * INODE_TAIL_ALIGN + tail_size;
+    return size < sizeof(struct inode) ? sizeof(struct inode) : size;
+}
+
+/* Return the memory after the name of node.
+ */
+static void* inode_tail( const struct inode* node )
+{
+    size_t offset = offsetof( struct inode, name ) + strlen( node->name ) + 1;
+    offset = ( offset + INODE_TAIL_ALIGN - 1 ) / INODE_TAIL_ALIGN * INODE_TAIL_ALIGN;
+    return (char*)node + offset;
+}
+
+static struct dir_extra* dir_extra( const struct inode* dir )
+{
+    return inode_tail( dir );
+}
+
+/* Take size bytes for an inode from the slabs or the arena and set
+ * its in_arena field. Returns NULL if memory runs out.
+ */
+static struct inode* arena_inode_struct( size_t size )
+{
+    if( inode_arena == NULL )
+    {
+        inode_arena = arena_create( INODE_ARENA_REGION_SIZE );
+        if( inode_arena == NULL ) return NULL;
     }
 
-    // Return the new inode
-    return new_inode;
+    struct inode* node;
+    int           class = ( size + INODE_SLAB_STEP - 1 ) / INODE_SLAB_STEP;
+    if( class <= INODE_SLAB_CLASSES )
+    {
+        if( inode_slabs[class-1] == NULL )
+            inode_slabs[class-1] = slab_create( class * INODE_SLAB_STEP, INODE_SLAB_OBJECTS );
+        if( inode_slabs[class-1] == NULL ) return NULL;
+        node = slab_alloc( inode_slabs[class-1] );
+    }
+    else
+    {
+        class = INODE_SLAB_CLASSES + 1;
+        node  = arena_alloc( inode_arena, size );
+    }
+    if( node == NULL ) return NULL;
+    node->in_arena = class;
+    return node;
 }
 
-/* Create a directory below the inode parent. Parent must
- * be a directory.
- * Returns a pointer to file's inodes.
+/* Return a new zeroed inode with the first len characters of name as
+ * its name and room for tail_size bytes after it, from the slabs in
+ * arena mode and from malloc otherwise. Returns NULL if memory runs
+ * out.
  */
-struct inode* create_dir(struct inode* parent, char* name) {
-    // Allocate memory for the new directory inode
-    struct inode* new_directory = (struct inode*)calloc(1, sizeof(struct inode));
-    if (new_directory == NULL) {
-        printf("Memory allocation failed\n");
-        return NULL;
+static struct inode* new_inode_struct( const char* name, size_t len, size_t tail_size )
+{
+    size_t        size = inode_size( len, tail_size );
+    struct inode* node;
+    if( !use_arena )
+    {
+        FS_STATS_COUNT( FS_COUNT_INODE_MALLOCS, 1 );
+        node = calloc( 1, size );
+        if( node ) __atomic_fetch_add( &live_heap_inodes, 1, __ATOMIC_RELAXED );
+    }
+    else
+    {
+        node = arena_inode_struct( size );
+        if( node ) live_arena_inodes++;
     }
+    if( node == NULL ) return NULL;
 
-    // Link new directory to parent if parent is not NULL
-    if (parent != NULL) {
-        parent->num_children++;
-        parent->children = (struct inode**)realloc(parent->children, parent->num_children * sizeof(struct inode*));
-        parent->children[parent->num_children - 1] = new_directory;
+    memcpy( node->name, name, len );
+    node->name[len] = '\0';
+    return node;
+}
+
+/* Allocate a zeroed array of count elements of size bytes that belongs
+ * to owner. It comes from the arena if owner does.
+ */
+static void* node_calloc( const struct inode* owner, size_t count, size_t size )
+{
+    if( owner->in_arena )
+        return arena_alloc( inode_arena, count * size );
+    FS_STATS_COUNT( FS_COUNT_INODE_MALLOCS, 1 );
+    return calloc( count, size );
+}
+
+/* Release memory that was allocated by node_calloc() for owner. Arena
+ * memory is only released together with the arena.
+ */
+static void node_free( const struct inode* owner, void* ptr )
+{
+    if( !owner->in_arena )
+        free( ptr );
+}
+
+/* Allocate the children array of a new or loaded directory with room
+ * for num_children entries.
+ */
+static struct inode** new_children_array( struct inode* dir, int num_children )
+{
+    int capacity = num_children ? num_children : 1;
+    dir->children_capacity = capacity;
+    return node_calloc( dir, capacity, sizeof(struct inode*) );
+}
+
+/* Make room for capacity children in the children array of dir.
+ * Returns 0 in case of success and -1 if memory runs out, in which
+ * case dir is unchanged.
+ */
+static int reserve_children( struct inode* dir, int capacity )
+{
+    if( dir->children != NULL && capacity <= dir->children_capacity ) return 0;
+
+    struct inode** children;
+    if( !dir->in_arena )
+    {
+        FS_STATS_COUNT( FS_COUNT_INODE_MALLOCS, 1 );
+        children = realloc( dir->children, capacity * sizeof(struct inode*) );
+        if( children == NULL ) return -1;
+    }
+    else
+    {
+        children = arena_alloc( inode_arena, capacity * sizeof(struct inode*) );
+        if( children == NULL ) return -1;
+        if( dir->num_children > 0 ) memcpy( children, dir->children, dir->num_children * sizeof(struct inode*) );
     }
+    dir->children          = children;
+    dir->children_capacity = capacity;
+    return 0;
+}
 
-    // Set attributes for the new directory inode
-    new_directory->id = next_inode_id();
-    new_directory->name = strdup(name);  // Allocate memory for the name and copy it
-    new_directory->is_directory = 1;
-    new_directory->num_children = 0;
-    new_directory->children = (struct inode**)calloc(1, sizeof(struct inode*));
-    if (new_directory->children == NULL) {
-        printf("Memory allocation failed\n");
-        free(new_directory);
-        return NULL;
+/* Append child to the children array of dir. The array grows by
+ * doubling, so that filling a directory copies every entry only a
+ * constant number of times. Returns 0 in case of success and -1 if
+ * memory runs out, in which case dir is unchanged.
+ */
+static int append_child( struct inode* dir, struct inode* child )
+{
+    int n = dir->num_children;
+    if( dir->children == NULL || n == dir->children_capacity )
+    {
+        if( reserve_children( dir, dir->children_capacity < 4 ? 4 : 2 * dir->children_capacity ) != 0 )
+            return -1;
     }
-    new_directory->filesize = 0;
-    new_directory->num_blocks = 0;
-    new_directory->blocks = NULL;
+    dir->children[n] = child;
+    dir->num_children = n + 1;
+    return 0;
+}
 
-    // Return the new inode
-    return new_directory;
+/* An open addressing hash table over the children of a directory,
+ * keyed by name. A slot holds the position of a child in the children
+ * array plus one, or 0 if it is empty; a 32 bit position takes half
+ * the memory of a pointer. capacity is a power of two and at least
+ * twice the number of entries. If several children have the same
+ * name, only the first of them in the children array is in the index,
+ * which is the one a linear search would find, and duplicates is set.
+ */
+struct dir_index
+{
+    int           capacity;
+    int           count;
+    int           duplicates;
+    unsigned int* slots;
+};
+
+/* FNV-1a hash of a name.
+ */
+static unsigned int hash_name( const char* name )
+{
+    unsigned int h = 2166136261u;
+    for( const unsigned char* p = (const unsigned char*)name; *p; p++ )
+    {
+        h ^= *p;
+        h *= 16777619u;
+    }
+    return h;
 }
 
-struct inode* find_inode_by_id( struct inode** inodeContainer, int antNoder, int id )
+static void dir_index_free( struct inode* dir )
 {
-    //"Parent must point to a directory inode. If no such inode exists, then the function returns NULL." 
-    //Litt usikker paa om man maa skrive if ( parent->is_directory == 0 ) isteden
-    for (int i = 0; i<antNoder; i++){
+    struct dir_extra* extra = dir_extra( dir );
+    if( extra->index )
+    {
+        node_free( dir, extra->index->slots );
+        node_free( dir, extra->index );
+        extra->index = NULL;
+    }
+}
+
+/* Return the slot of index, the index of dir, that holds a child with
+ * this name, or the empty slot where it would be inserted.
+ */
+static int dir_index_slot( const struct inode* dir, const struct dir_index* index, const char* name, unsigned int hash )
+{
+    int mask = index->capacity - 1;
+    int i    = hash & mask;
+    while( index->slots[i] != 0 )
+    {
+        const struct inode* child = dir->children[index->slots[i] - 1];
+        if( child->name_hash == hash && strcmp( child->name, name ) == 0 )
+            break;
+        i = ( i + 1 ) & mask;
+    }
+    return i;
+}
+
+/* Add the child at position pos of dir to the index of dir unless a
+ * child with the same name is in the index already. Returns 0 in case
+ * of success and -1 if memory runs out; the index is dropped in that
+ * case and rebuilt later.
+ */
+static int dir_index_insert( struct inode* dir, int pos )
+{
+    struct dir_index* index = dir_extra( dir )->index;
+    if( index == NULL ) return 0;
+
+    if( ( index->count + 1 ) * 2 > index->capacity )
+    {
+        int           capacity = index->capacity * 2;
+        unsigned int* slots    = node_calloc( dir, capacity, sizeof(unsigned int) );
+        if( slots == NULL )
+        {
+            dir_index_free( dir );
+            return -1;
+        }
 
-        if (inodeContainer[i]->id == id){
-        	return inodeContainer[i];
+        unsigned int* old_slots    = index->slots;
+        int           old_capacity = index->capacity;
+        index->slots    = slots;
+        index->capacity = capacity;
+        for( int i = 0; i < old_capacity; i++ )
+        {
+            if( old_slots[i] )
+            {
+                const struct inode* child = dir->children[old_slots[i] - 1];
+                index->slots[dir_index_slot( dir, index, child->name, child->name_hash )] = old_slots[i];
+            }
         }
+        node_free( dir, old_slots );
     }
-    return NULL;
+
+    const struct inode* child = dir->children[pos];
+    int i = dir_index_slot( dir, index, child->name, child->name_hash );
+    if( index->slots[i] == 0 )
+    {
+        index->slots[i] = pos + 1;
+        index->count++;
+    }
+    else if( index->slots[i] != (unsigned int)pos + 1 )
+    {
+        index->duplicates = 1;
+    }
+    return 0;
 }
 
-struct inode* find_inode_by_name( struct inode* parent, char* name )
+/* Remove the child at position pos of dir from the index of dir. Must
+ * be called while the child is still at that position.
+ */
+static void dir_index_remove( struct inode* dir, int pos )
 {
-    //"Parent must point to a directory inode. If no such inode exists, then the function returns NULL." 
-    //Litt usikker paa om man maa skrive if ( parent->is_directory == 0 ) isteden
-    if(parent->is_directory == '\0'){
-        fprintf(stderr, "Parent inode is not a directory.\n");
-        return NULL;
+    struct dir_index* index = dir_extra( dir )->index;
+    if( index == NULL ) return;
+
+    const struct inode* child = dir->children[pos];
+    int i = dir_index_slot( dir, index, child->name, child->name_hash );
+    if( index->slots[i] != (unsigned int)pos + 1 ) return;
+
+    /* Backward shift deletion: move later entries of the same probe
+     * sequence into the hole so that no tombstones are needed.
+     */
+    int mask = index->capacity - 1;
+    index->slots[i] = 0;
+    index->count--;
+    int j = ( i + 1 ) & mask;
+    while( index->slots[j] != 0 )
+    {
+        int home = dir->children[index->slots[j] - 1]->name_hash & mask;
+        if( ( ( j - home ) & mask ) >= ( ( j - i ) & mask ) )
+        {
+            index->slots[i] = index->slots[j];
+            index->slots[j] = 0;
+            i = j;
+        }
+        j = ( j + 1 ) & mask;
+    }
+}
+
+/* After a child with this name was removed, another child with the
+ * same name may have to take its place in the index. Only look for one
+ * if there ever was a duplicate, because that costs a pass over all
+ * children.
+ */
+static void dir_index_readd( struct inode* dir, const struct inode* child )
+{
+    const struct dir_index* index = dir_extra( dir )->index;
+    for( int k = 0; index && index->duplicates && k < dir->num_children; k++ )
+    {
+        const struct inode* other = dir->children[k];
+        if( other->name_hash == child->name_hash && strcmp( other->name, child->name ) == 0 )
+        {
+            dir_index_insert( dir, k );
+            break;
+        }
+    }
+}
+
+/* Build the index of dir from its children array.
+ */
+static void dir_index_build( struct inode* dir )
+{
+    struct dir_index* index = node_calloc( dir, 1, sizeof(struct dir_index) );
+    if( index == NULL ) return;
+
+    index->capacity = 64;
+    while( index->capacity < dir->num_children * 2 )
+        index->capacity *= 2;
+
+    index->slots = node_calloc( dir, index->capacity, sizeof(unsigned int) );
+    if( index->slots == NULL )
+    {
+        node_free( dir, index );
+        return;
     }
 
-    for(int i = 0; i < parent->num_children; i++){
+    dir_extra( dir )->index = index;
+    for( int i = 0; i < dir->num_children; i++ )
+    {
+        if( dir_index_insert( dir, i ) != 0 )
+            return;
+    }
+}
 
-           struct inode* child = (struct inode*) parent->children[i];
+/* How remove_child() closes the gap, see set_child_removal().
+ */
+static int child_removal = CHILD_REMOVAL_SHIFT;
 
-           if(strcmp(child->name, name) == 0){
-               return child;
-           }
-       }
-    return NULL;
+void set_child_removal( int removal )
+{
+    if( removal != CHILD_REMOVAL_SHIFT && removal != CHILD_REMOVAL_SWAP )
+    {
+        fprintf( stderr, "Unknown child removal %d\n", removal );
+        return;
+    }
+    child_removal = removal;
 }
 
-void set_pointer( struct inode* parent, struct inode** inodeContainer, int antNoder){
-
-	for (int i = 0; i < parent->num_children; i++){
-        for (int j = 0; j < antNoder; j++) {
-
-            if (parent->children[i]->id == inodeContainer[j]->id ) {
-                //perform swap of inodes, so iNode->children will get nodes we want and inodeContainer will get the filler nodes
-                
-		//Proposed solution no 1
-		//struct inode* fromContainer = malloc(sizeof(struct inode));
-		//fromContainer = inodeContainer[j];
-		//inodeContainer[j] = parent->children[i];
-		//parent->children[i] = fromContainer;
-		//free (fromContainer);
-                //break;
-		
-		//Proposed solution no 2
-                free(parent->children[i]);
-                parent->children[i] = inodeContainer[j];
-                break;
-            }		
+/* The child at position last of dir was moved to position pos by a
+ * swap. Its slot must follow it, and it may have become the first
+ * child with its name, which is the one the index must hold. The old
+ * entry at position last is still readable.
+ */
+static void dir_index_update_moved( struct inode* dir, int pos, int last )
+{
+    struct dir_index* index = dir_extra( dir )->index;
+    if( index == NULL ) return;
+
+    const struct inode* child = dir->children[pos];
+    int          i     = dir_index_slot( dir, index, child->name, child->name_hash );
+    unsigned int first = index->slots[i];
+    if( first == 0 )
+    {
+        dir_index_insert( dir, pos );
+        return;
+    }
+    if( first == (unsigned int)last + 1 || first > (unsigned int)pos + 1 )
+        index->slots[i] = pos + 1;
+}
+
+/* The children after position pos up to last are about to move one
+ * position down. If only a few of them move, their slots are found by
+ * following their probe sequences; otherwise all slots are checked.
+ */
+static void dir_index_shift( struct inode* dir, int pos, int last )
+{
+    struct dir_index* index = dir_extra( dir )->index;
+    if( index == NULL ) return;
+
+    if( ( last - pos ) * 64 < index->capacity )
+    {
+        int mask = index->capacity - 1;
+        for( int k = pos + 1; k <= last; k++ )
+        {
+            int i = dir->children[k]->name_hash & mask;
+            while( index->slots[i] != 0 && index->slots[i] != (unsigned int)k + 1 )
+                i = ( i + 1 ) & mask;
+            if( index->slots[i] != 0 )
+                index->slots[i] = k;
+        }
+        return;
+    }
+
+    /* Without a branch, the compiler can vectorize the loop */
+    unsigned int* slots = index->slots;
+    unsigned int  limit = pos + 1;
+    for( int i = 0; i < index->capacity; i++ )
+        slots[i] -= ( slots[i] > limit );
+}
+
+/* Remove the child at position pos of dir, either by moving all later
+ * children one position down or by moving the last child into the gap.
+ * A heap array shrinks by half once it is less than a quarter full.
+ */
+static void remove_child( struct inode* dir, int pos )
+{
+    struct inode* child = dir->children[pos];
+    int           last  = dir->num_children - 1;
+
+    dir_index_remove( dir, pos );
+    if( child_removal == CHILD_REMOVAL_SWAP )
+    {
+        dir->children[pos] = dir->children[last];
+    }
+    else
+    {
+        dir_index_shift( dir, pos, last );
+        memmove( &dir->children[pos], &dir->children[pos+1], ( last - pos ) * sizeof(struct inode*) );
+    }
+    dir->num_children = last;
+
+    dir_index_readd( dir, child );
+    if( child_removal == CHILD_REMOVAL_SWAP && pos < last )
+        dir_index_update_moved( dir, pos, last );
+
+    if( !dir->in_arena && dir->children_capacity > 16 && dir->num_children < dir->children_capacity / 4 )
+    {
+        int            capacity = dir->children_capacity / 2;
+        struct inode** children = realloc( dir->children, capacity * sizeof(struct inode*) );
+        FS_STATS_COUNT( FS_COUNT_INODE_MALLOCS, 1 );
+        if( children )
+        {
+            dir->children          = children;
+            dir->children_capacity = capacity;
         }
-	}
+    }
+}
+
+/* Bookkeeping for update_inodes(). mft_file_name is the master file
+ * table that holds the records at mft_offset of the inodes, i.e. the
+ * one that was loaded or saved last. dirty_nodes lists the inodes whose
+ * record must be written again; inode->dirty is its position in the
+ * list plus one, or 0. dead_records lists the records of deleted
+ * inodes. If one of the lists cannot grow, the next update writes the
+ * whole table.
+ */
+struct mft_slot
+{
+    long offset;
+    int  size;
+};
+
+static char*            mft_file_name  = NULL;
+static struct inode**   dirty_nodes    = NULL;
+static int              num_dirty      = 0;
+static int              dirty_capacity = 0;
+static struct mft_slot* dead_records   = NULL;
+static int              num_dead       = 0;
+static int              dead_capacity  = 0;
+static int              dirty_overflow = 0;
+
+static void mark_dirty( struct inode* node )
+{
+    if( concurrent )
+    {
+        __atomic_store_n( &dirty_overflow, 1, __ATOMIC_RELAXED );
+        return;
+    }
+    if( node == NULL || node->dirty ) return;
+
+    if( num_dirty == dirty_capacity )
+    {
+        int             capacity = dirty_capacity ? 2 * dirty_capacity : 64;
+        struct inode**  bigger   = realloc( dirty_nodes, capacity * sizeof(struct inode*) );
+        if( bigger == NULL )
+        {
+            dirty_overflow = 1;
+            return;
+        }
+        dirty_nodes    = bigger;
+        dirty_capacity = capacity;
+    }
+    dirty_nodes[num_dirty++] = node;
+    node->dirty = num_dirty;
+}
+
+static void unmark_dirty( struct inode* node )
+{
+    if( node->dirty == 0 ) return;
+
+    struct inode* last = dirty_nodes[--num_dirty];
+    dirty_nodes[node->dirty - 1] = last;
+    last->dirty = node->dirty;
+    node->dirty = 0;
+}
+
+/* Remember that the record of node, which is being deleted, is dead.
+ */
+static void forget_record( struct inode* node )
+{
+    if( node->mft_size == 0 || concurrent ) return;
+
+    if( num_dead == dead_capacity )
+    {
+        int              capacity = dead_capacity ? 2 * dead_capacity : 64;
+        struct mft_slot* bigger   = realloc( dead_records, capacity * sizeof(struct mft_slot) );
+        if( bigger == NULL )
+        {
+            dirty_overflow = 1;
+            return;
+        }
+        dead_records  = bigger;
+        dead_capacity = capacity;
+    }
+    dead_records[num_dead].offset = node->mft_offset;
+    dead_records[num_dead].size   = node->mft_size;
+    num_dead++;
+}
+
+/* Forget all changes after they were written.
+ */
+static void clear_changes( )
+{
+    for( int i = 0; i < num_dirty; i++ )
+        dirty_nodes[i]->dirty = 0;
+    num_dirty      = 0;
+    num_dead       = 0;
+    dirty_overflow = 0;
+}
+
+/* Start over after the whole table was read or written: name is now
+ * the file that holds the records of the inodes.
+ */
+static void remember_mft( const char* name )
+{
+    clear_changes( );
+    free( mft_file_name );
+    mft_file_name = strdup( name );
+}
+
+/* Destroy the slabs and the arena with all the inodes in them.
+ */
+static void release_arena( )
+{
+    for( int c = 0; c < INODE_SLAB_CLASSES; c++ )
+    {
+        slab_destroy( inode_slabs[c] );
+        inode_slabs[c] = NULL;
+    }
+    arena_destroy( inode_arena );
+    inode_arena       = NULL;
+    live_arena_inodes = 0;
+}
+
+/* Release the memory of a single inode. Children are not touched.
+ * When the last arena inode is gone, the arena and the slabs go, too.
+ */
+static void free_inode_struct( struct inode* node )
+{
+    unmark_dirty( node );
+
+    struct dir_extra* extra = node->is_directory ? dir_extra( node ) : NULL;
+    if( extra && extra->lock )
+    {
+        pthread_rwlock_destroy( &extra->lock->rwlock );
+        free( extra->lock );
+        extra->lock = NULL;
+    }
+
+    if( !node->in_arena )
+    {
+        if( node->is_directory )
+        {
+            free( node->children );
+            dir_index_free( node );
+        }
+        else
+        {
+            /* Only arrays that did not fit after the name are separate */
+            void* tail = inode_tail( node );
+            if( (void*)node->blocks != tail ) free( node->blocks );
+        }
+        free( node );
+        __atomic_fetch_sub( &live_heap_inodes, 1, __ATOMIC_RELAXED );
+        return;
+    }
+
+    if( node->in_arena <= INODE_SLAB_CLASSES )
+        slab_free( inode_slabs[node->in_arena-1], node );
+    live_arena_inodes--;
+    if( live_arena_inodes == 0 )
+    {
+        release_arena( );
+    }
+}
+
+/* The cache used by lookup_path(). It is direct mapped: a (directory,
+ * name) pair can only live in one slot, and a new pair replaces the
+ * old one. node is NULL for names that were not found. Directories
+ * are identified by address and id together, because ids are never
+ * reused while the tree is in memory, but addresses are.
+ * generation is increased to drop all entries at once.
+ */
+#define DENTRY_CACHE_SIZE 4096
+#define DENTRY_NAME_LEN   48
+
+struct dentry
+{
+    const struct inode* parent;
+    int                 parent_id;
+    unsigned int        generation;
+    unsigned int        name_hash;
+    struct inode*       node;
+    char                name[DENTRY_NAME_LEN];
+};
+
+static struct dentry dentry_cache[DENTRY_CACHE_SIZE];
+static unsigned int  dentry_generation = 1;
+
+void dentry_cache_clear( )
+{
+    /* Unused entries have generation 0, so it must never be current */
+    dentry_generation++;
+    if( dentry_generation == 0 ) dentry_generation = 1;
+}
+
+static struct dentry* dentry_slot( const struct inode* parent, unsigned int hash )
+{
+    size_t key = ( (size_t)parent >> 4 ) * 0x9E3779B1u ^ hash;
+    return &dentry_cache[key & ( DENTRY_CACHE_SIZE - 1 )];
+}
+
+/* Return the cache entry for (parent, name), or NULL if there is none.
+ */
+static struct dentry* dentry_find( const struct inode* parent, const char* name, unsigned int hash )
+{
+    struct dentry* d = dentry_slot( parent, hash );
+    if( d->generation == dentry_generation && d->parent == parent &&
+        d->parent_id == parent->id && d->name_hash == hash &&
+        strcmp( d->name, name ) == 0 )
+    {
+        return d;
+    }
+    return NULL;
+}
+
+static void dentry_store( const struct inode* parent, const char* name, unsigned int hash, struct inode* node )
+{
+    if( strlen( name ) >= DENTRY_NAME_LEN ) return;
+
+    struct dentry* d = dentry_slot( parent, hash );
+    d->parent     = parent;
+    d->parent_id  = parent->id;
+    d->generation = dentry_generation;
+    d->name_hash  = hash;
+    d->node       = node;
+    strcpy( d->name, name );
+}
+
+/* Called whenever the child name of parent is created or deleted.
+ */
+static void dentry_invalidate( const struct inode* parent, const char* name )
+{
+    if( concurrent ) return;
+    struct dentry* d = dentry_find( parent, name, hash_name( name ) );
+    if( d ) d->generation = 0;
+}
+
+void set_file_layout( int layout )
+{
+    if( layout != FILE_LAYOUT_BLOCKS && layout != FILE_LAYOUT_EXTENTS )
+    {
+        fprintf( stderr, "Unknown file layout %d\n", layout );
+        return;
+    }
+    file_layout = layout;
+}
+
+void block_iterator_init( struct block_iterator* it, const struct inode* node )
+{
+    it->node   = node;
+    it->index  = 0;
+    it->extent = 0;
+    it->offset = 0;
+}
+
+int block_iterator_next( struct block_iterator* it, size_t* block )
+{
+    const struct inode* node = it->node;
+
+    if( node->is_directory ) return 0;
+
+    if( node->num_extents )
+    {
+        while( it->extent < node->num_extents &&
+               it->offset >= node->extents[it->extent].length )
+        {
+            it->extent++;
+            it->offset = 0;
+        }
+        if( it->extent >= node->num_extents ) return 0;
+
+        *block = node->extents[it->extent].start + it->offset;
+        it->offset++;
+        return 1;
+    }
+
+    if( it->index >= node->num_blocks || node->blocks == NULL ) return 0;
+
+    *block = node->blocks[it->index];
+    it->index++;
+    return 1;
+}
+
+/* The number of bytes that a new file keeps after its name for a
+ * block list of num_blocks blocks. With extents, there is room for at
+ * least one extent, so that the extents of a contiguous file can take
+ * the place of the block list.
+ */
+static size_t file_tail_size( int num_blocks )
+{
+    size_t size = num_blocks * sizeof(size_t);
+    if( file_layout == FILE_LAYOUT_EXTENTS && size < sizeof(struct extent) )
+        size = sizeof(struct extent);
+    return size;
+}
+
+/* Replace the block list of a file by extents. Consecutive block
+ * numbers are merged into one extent. The extents are stored in place
+ * of the block list if they fit there, and in an array of their own
+ * otherwise.
+ * Returns 0 in case of success and -1 if memory runs out, in which
+ * case the block list is kept.
+ */
+static int blocks_to_extents( struct inode* node )
+{
+    int num_extents = 0;
+    for( int i = 0; i < node->num_blocks; i++ )
+    {
+        if( i == 0 || node->blocks[i] != node->blocks[i-1] + 1 )
+            num_extents++;
+    }
+
+    int            in_tail = ( num_extents * sizeof(struct extent) <= file_tail_size( node->num_blocks ) );
+    struct extent* extents;
+    if( in_tail )
+        extents = malloc( ( num_extents ? num_extents : 1 ) * sizeof(struct extent) );
+    else
+        extents = node_calloc( node, num_extents ? num_extents : 1, sizeof(struct extent) );
+    if( extents == NULL ) return -1;
+
+    int e = -1;
+    for( int i = 0; i < node->num_blocks; i++ )
+    {
+        if( i == 0 || node->blocks[i] != node->blocks[i-1] + 1 )
+        {
+            e++;
+            extents[e].start  = node->blocks[i];
+            extents[e].length = 0;
+        }
+        extents[e].length++;
+    }
+
+    if( in_tail )
+    {
+        /* The block list is not needed any more, and the extents
+         * overwrite it
+         */
+        memcpy( node->blocks, extents, num_extents * sizeof(struct extent) );
+        free( extents );
+        extents = (struct extent*)node->blocks;
+    }
+    node->num_extents = num_extents;
+    node->extents     = extents;
+    return 0;
+}
+
+/* Allocate a file inode with its name and an empty block list that is
+ * large enough for size_in_bytes. Returns NULL if memory runs out.
+ */
+static struct inode* new_file_inode(char* name, int size_in_bytes) {
+    int num_blocks = size_in_bytes / BLOCKSIZE + 1;
+
+    // The name and the block list are stored together with the inode
+    struct inode* new_inode = new_inode_struct(name, strlen(name), file_tail_size(num_blocks));
+    if (new_inode == NULL) {
+        printf("Memory allocation failed\n");
+        return NULL;
+    }
+
+    new_inode->num_blocks = num_blocks;
+    new_inode->blocks = inode_tail(new_inode);
+    return new_inode;
+}
+
+/* Add the file new_inode, whose blocks are allocated already, to
+ * parent and give it an id. If memory runs out, its blocks are freed
+ * and NULL is returned.
+ */
+static struct inode* link_file(struct inode* parent, struct inode* new_inode, char* name, int size_in_bytes) {
+    // The block list is only needed until the extents are built
+    if (file_layout == FILE_LAYOUT_EXTENTS) {
+        blocks_to_extents(new_inode);
+    }
+
+    // Add the new file inode to the parent directory's list of children
+    int locked = (lock_dir(parent, 1) == 0);
+    if (!locked || append_child(parent, new_inode) != 0) {
+        if (locked) unlock_dir(parent);
+        printf("Memory allocation failed\n");
+        struct block_iterator it;
+        size_t block;
+        block_iterator_init(&it, new_inode);
+        while (block_iterator_next(&it, &block)) {
+            free_block(block);
+        }
+        free_inode_struct(new_inode);
+        return NULL;
+    }
+
+    // Set attributes for the new inode
+    new_inode->id = next_inode_id();
+    new_inode->name_hash = hash_name(name);
+    new_inode->is_directory = 0;
+    new_inode->num_children = 0;
+    new_inode->filesize = size_in_bytes;
+    dir_index_insert(parent, parent->num_children - 1);
+    dentry_invalidate(parent, name);
+    journal_create(parent, new_inode);
+    unlock_dir(parent);
+    mark_dirty(parent);
+    mark_dirty(new_inode);
+
+    // Return the new inode
+    return new_inode;
+}
+
+/* Create a file below the inode parent. Parent must
+ * be a directory. The size of the file is size_in_bytes,
+ * and create_file calls the allocate_blocks() function
+ * to reserve enough blocks in the simulated disk to store
+ * all of these bytes.
+ * Returns a pointer to file's inodes, or NULL if the disk
+ * is full. In that case, no blocks stay allocated.
+ */
+struct inode* create_file(struct inode* parent, char* name, int size_in_bytes) {
+    FS_STATS_TIME( FS_OP_CREATE_FILE );
+    // Allocate memory for the new inode
+    struct inode* new_inode = new_file_inode(name, size_in_bytes);
+    if (new_inode == NULL) {
+        return NULL;
+    }
+
+    // Reserve all blocks for the file in one step. allocate_blocks() either
+    // allocates all of them or none, so nothing leaks on a full disk, and the
+    // parent is only changed once the file is complete.
+    int allocated;
+    if (file_layout == FILE_LAYOUT_EXTENTS) {
+        allocated = allocate_contiguous_blocks(new_inode->num_blocks, new_inode->blocks);
+    } else {
+        allocated = allocate_blocks(new_inode->num_blocks, new_inode->blocks);
+    }
+    if (allocated != 0) {
+        // Error: Not enough space on the simulated disk
+        free_inode_struct(new_inode);
+        printf("Error: Not enough space on the disk\n");
+        return NULL;
+    }
+
+    return link_file(parent, new_inode, name, size_in_bytes);
+}
+
+/* Create a directory below the inode parent. Parent must
+ * be a directory.
+ * Returns a pointer to file's inodes.
+ */
+struct inode* create_dir(struct inode* parent, char* name) {
+    FS_STATS_TIME( FS_OP_CREATE_DIR );
+    // Allocate memory for the new directory inode and its name
+    struct inode* new_directory = new_inode_struct(name, strlen(name), sizeof(struct dir_extra));
+    if (new_directory == NULL) {
+        printf("Memory allocation failed\n");
+        return NULL;
+    }
+
+    new_directory->is_directory = 1;
+    new_directory->children = new_children_array(new_directory, 0);
+    if (new_directory->children == NULL) {
+        printf("Memory allocation failed\n");
+        free_inode_struct(new_directory);
+        return NULL;
+    }
+
+    // Set attributes for the new directory inode
+    new_directory->id = next_inode_id();
+    new_directory->num_children = 0;
+    new_directory->filesize = 0;
+    new_directory->num_blocks = 0;
+    new_directory->name_hash = hash_name(name);
+
+    // Link new directory to parent if parent is not NULL
+    if (parent != NULL) {
+        if (lock_dir(parent, 1) != 0) {
+            free_inode_struct(new_directory);
+            return NULL;
+        }
+        if (append_child(parent, new_directory) != 0) {
+            unlock_dir(parent);
+            printf("Memory allocation failed\n");
+            free_inode_struct(new_directory);
+            return NULL;
+        }
+        dir_index_insert(parent, parent->num_children - 1);
+        dentry_invalidate(parent, name);
+        journal_create(parent, new_directory);
+        unlock_dir(parent);
+    } else {
+        journal_create(parent, new_directory);
+        __atomic_fetch_add(&live_roots, 1, __ATOMIC_RELAXED);
+    }
+    mark_dirty(parent);
+    mark_dirty(new_directory);
+
+    // Return the new inode
+    return new_directory;
+}
+
+/* Return the first child of parent with this name, through the index
+ * if parent has one.
+ */
+static struct inode* search_children( struct inode* parent, const char* name )
+{
+    const struct dir_index* index = dir_extra( parent )->index;
+    if( index != NULL )
+    {
+        unsigned int hash = hash_name( name );
+        unsigned int slot = index->slots[dir_index_slot( parent, index, name, hash )];
+        return slot ? parent->children[slot - 1] : NULL;
+    }
+
+    for( int i = 0; i < parent->num_children; i++ )
+    {
+        struct inode* child = parent->children[i];
+        if( strcmp( child->name, name ) == 0 )
+        {
+            return child;
+        }
+    }
+    return NULL;
+}
+
+struct inode* find_inode_by_name( struct inode* parent, char* name )
+{
+    FS_STATS_TIME( FS_OP_FIND_INODE_BY_NAME );
+    //"Parent must point to a directory inode. If no such inode exists, then the function returns NULL." 
+    //Litt usikker paa om man maa skrive if ( parent->is_directory == 0 ) isteden
+    if(parent->is_directory == '\0'){
+        fprintf(stderr, "Parent inode is not a directory.\n");
+        return NULL;
+    }
+
+    if(!concurrent){
+        if(dir_extra(parent)->index == NULL && parent->num_children >= DIR_INDEX_THRESHOLD){
+            dir_index_build(parent);
+        }
+        return search_children(parent, name);
+    }
+
+    // Building the index changes the directory, so it needs the write lock
+    if(lock_dir(parent, 0) != 0) return NULL;
+    if(dir_extra(parent)->index == NULL && parent->num_children >= DIR_INDEX_THRESHOLD){
+        unlock_dir(parent);
+        lock_dir(parent, 1);
+        if(dir_extra(parent)->index == NULL && parent->num_children >= DIR_INDEX_THRESHOLD){
+            dir_index_build(parent);
+        }
+        unlock_dir(parent);
+        lock_dir(parent, 0);
+    }
+    struct inode* child = search_children(parent, name);
+    unlock_dir(parent);
+    return child;
+}
+
+struct inode* lookup_path( struct inode* root, const char* path )
+{
+    FS_STATS_TIME( FS_OP_LOOKUP_PATH );
+    struct inode* node = root;
+    const char*   p    = path;
+
+    while( node != NULL )
+    {
+        while( *p == '/' ) p++;
+        if( *p == '\0' ) break;
+
+        const char* end = p;
+        while( *end != '/' && *end != '\0' ) end++;
+
+        if( !node->is_directory ) return NULL;
+
+        char   component[DENTRY_NAME_LEN];
+        char*  name = component;
+        size_t len  = end - p;
+        if( len >= DENTRY_NAME_LEN )
+        {
+            name = malloc( len + 1 );
+            if( name == NULL ) return NULL;
+        }
+        memcpy( name, p, len );
+        name[len] = '\0';
+
+        if( concurrent )
+        {
+            node = find_inode_by_name( node, name );
+        }
+        else
+        {
+            unsigned int   hash = hash_name( name );
+            struct dentry* d    = dentry_find( node, name, hash );
+            if( d )
+            {
+                node = d->node;
+            }
+            else
+            {
+                struct inode* child = find_inode_by_name( node, name );
+                dentry_store( node, name, hash, child );
+                node = child;
+            }
+        }
+
+        if( name != component ) free( name );
+        p = end;
+    }
+    return node;
+}
+
+/* Return the position of node in the children array of parent, or -1
+ * if it is not a direct child. Pointers are compared, so that the
+ * children themselves are not touched, and the array is searched from
+ * both ends, so that the first and the last children are found at once.
+ */
+static int child_position( struct inode* parent, struct inode* node )
+{
+    if (!parent->is_directory){
+    fprintf(stderr, "is_node_in_parent: Parent inode %s is not a directory.\n", parent->name);    return -1;
+    }
+
+    for (int i = 0, j = parent->num_children - 1; i <= j; i++, j--)
+    {
+        if (parent->children[i] == node) return i;
+        if (parent->children[j] == node) return j;
+    }
+    return -1;
+}
+
+/* Return an array of node and all inodes below it, parents before
+ * their children, and store their number in *count. The array itself
+ * serves as the queue of the walk, so deep trees need no recursion.
+ * Returns NULL if memory runs out.
+ */
+static struct inode** collect_subtree( struct inode* node, int* count )
+{
+    int            capacity = 64;
+    int            num      = 1;
+    struct inode** nodes    = malloc( capacity * sizeof(struct inode*) );
+    if( nodes == NULL ) return NULL;
+
+    nodes[0] = node;
+    for( int i = 0; i < num; i++ )
+    {
+        struct inode* dir = nodes[i];
+        if( !dir->is_directory ) continue;
+
+        if( num + dir->num_children > capacity )
+        {
+            while( num + dir->num_children > capacity ) capacity *= 2;
+            struct inode** bigger = realloc( nodes, capacity * sizeof(struct inode*) );
+            if( bigger == NULL )
+            {
+                free( nodes );
+                return NULL;
+            }
+            nodes = bigger;
+        }
+        memcpy( &nodes[num], dir->children, dir->num_children * sizeof(struct inode*) );
+        num += dir->num_children;
+    }
+    *count = num;
+    return nodes;
+}
+
+/* Free the blocks of the files among nodes with one update of the
+ * block allocation table. If there is no memory for the list of
+ * blocks, they are freed one by one.
+ */
+static void release_blocks( struct inode** nodes, int count )
+{
+    long total = 0;
+    for( int i = 0; i < count; i++ )
+    {
+        if( !nodes[i]->is_directory ) total += nodes[i]->num_blocks;
+    }
+    if( total == 0 ) return;
+
+    size_t* blocks = NULL;
+    if( total <= INT_MAX )
+    {
+        blocks = malloc( total * sizeof(size_t) );
+    }
+
+    long                  used = 0;
+    struct block_iterator it;
+    size_t                block;
+    for( int i = 0; i < count; i++ )
+    {
+        if( nodes[i]->is_directory ) continue;
+        block_iterator_init( &it, nodes[i] );
+        while( block_iterator_next( &it, &block ) )
+        {
+            if( blocks ) blocks[used++] = block;
+            else         free_block( block );
+        }
+    }
+
+    if( blocks )
+    {
+        free_blocks( used, blocks );
+        free( blocks );
+    }
+}
+
+int delete_file( struct inode* parent, struct inode* node )
+{
+    FS_STATS_TIME( FS_OP_DELETE_FILE );
+    //Det antas at parent faktisk er en directory og node er en file.
+    //Parent is a direct parent to the node, then the node can be deleted
+    if (lock_dir(parent, 1) != 0) return -1;
+    int pos = child_position(parent, node);
+    if (pos >= 0)
+    {
+        remove_child(parent, pos);
+        dentry_invalidate(parent, node->name);
+
+        journal_delete(parent, node);
+        unlock_dir(parent);
+        mark_dirty(parent);
+        forget_record(node);
+
+        release_blocks(&node, 1);
+
+        free_inode_struct(node);
+    }
+    else
+    {
+        unlock_dir(parent);
+        fprintf(stderr, "Parent is not a direct parent of node. The node will not be deleted.");
+        return -1;
+    }
+    return 0;
+
+}
+
+int delete_dir( struct inode* parent, struct inode* node )
+{
+    FS_STATS_TIME( FS_OP_DELETE_DIR );
+
+    //Det antas at begge parameterene parent og node faktisk er directories.
+    if (node->num_children != 0) // endret fra 0 til NULL
+    {
+        fprintf(stderr, "The node contains children. The node will not be deleted.\n");
+        return -1;
+    }
+
+    //Parent is a direct parent to the node AND the node has no children itself, then the node can be deleted
+    if (lock_dir(parent, 1) != 0) return -1;
+    int pos = child_position(parent, node);
+    if (pos >= 0)
+    {
+        remove_child(parent, pos);
+        dentry_invalidate(parent, node->name);
+
+        journal_delete(parent, node);
+        unlock_dir(parent);
+        mark_dirty(parent);
+        forget_record(node);
+        free_inode_struct(node);
+    }
+    else
+    {
+        unlock_dir(parent);
+        fprintf(stderr, "Parent is not a direct parent to the node. The node will not be deleted.");
+        return -1;
+    }
+
+    return 0;
+}
+
+int delete_tree( struct inode* parent, struct inode* node )
+{
+    FS_STATS_TIME( FS_OP_DELETE_TREE );
+    if( lock_dir( parent, 1 ) != 0 ) return -1;
+
+    int pos = child_position( parent, node );
+    if( pos < 0 )
+    {
+        unlock_dir( parent );
+        fprintf( stderr, "Parent is not a direct parent to the node. The node will not be deleted.\n" );
+        return -1;
+    }
+
+    int            count;
+    struct inode** nodes = collect_subtree( node, &count );
+    if( nodes == NULL )
+    {
+        unlock_dir( parent );
+        fprintf( stderr, "Memory allocation failed\n" );
+        return -1;
+    }
+
+    remove_child( parent, pos );
+    dentry_invalidate( parent, node->name );
+
+    journal_delete_tree( parent, node );
+    unlock_dir( parent );
+    mark_dirty( parent );
+
+    release_blocks( nodes, count );
+
+    for( int i = 0; i < count; i++ )
+    {
+        forget_record( nodes[i] );
+        free_inode_struct( nodes[i] );
+    }
+    free( nodes );
+    return 0;
+}
+
+/* Count the entries per parent path, so that the children array of
+ * each parent can be sized once. Paths are compared as strings; two
+ * spellings of the same directory only make the estimate smaller.
+ */
+struct parent_count
+{
+    const char* parent;
+    int         count;
+};
+
+static int parent_count_slot( const struct parent_count* table, int capacity, const char* parent )
+{
+    int i = hash_name( parent ) & ( capacity - 1 );
+    while( table[i].parent != NULL && strcmp( table[i].parent, parent ) != 0 )
+        i = ( i + 1 ) & ( capacity - 1 );
+    return i;
+}
+
+int create_batch( struct inode* root, const struct create_entry* entries, int num_entries )
+{
+    int capacity = 16;
+    while( capacity < num_entries * 2 )
+        capacity *= 2;
+
+    /* Blocks for all files are reserved by one allocate_blocks() call.
+     * First fit hands them out in the same order as one call per file
+     * would. Contiguous allocation depends on the files before, so
+     * FILE_LAYOUT_EXTENTS keeps allocating per file.
+     */
+    long total_blocks = 0;
+    for( int i = 0; i < num_entries; i++ )
+    {
+        if( entries[i].type == CREATE_ENTRY_FILE )
+            total_blocks += entries[i].size / BLOCKSIZE + 1;
+    }
+    int pooled = ( file_layout == FILE_LAYOUT_BLOCKS && total_blocks > 0 );
+
+    struct parent_count* counts = calloc( capacity, sizeof(struct parent_count) );
+    size_t*              pool   = malloc( ( pooled ? total_blocks : 1 ) * sizeof(size_t) );
+    if( counts == NULL || pool == NULL || total_blocks > INT_MAX )
+    {
+        fprintf( stderr, "Failed to allocate memory for %d entries\n", num_entries );
+        free( counts );
+        free( pool );
+        return -1;
+    }
+    if( pooled && allocate_blocks( (int)total_blocks, pool ) != 0 )
+    {
+        printf( "Error: Not enough space on the disk\n" );
+        free( counts );
+        free( pool );
+        return -1;
+    }
+
+    for( int i = 0; i < num_entries; i++ )
+    {
+        int slot = parent_count_slot( counts, capacity, entries[i].parent );
+        counts[slot].parent = entries[i].parent;
+        counts[slot].count++;
+    }
+
+    journal_deferred = 1;
+
+    long next_block = 0;
+    int  created    = 0;
+    for( ; created < num_entries; created++ )
+    {
+        const struct create_entry* e      = &entries[created];
+        struct inode*              parent = lookup_path( root, e->parent );
+        if( parent == NULL || !parent->is_directory )
+        {
+            fprintf( stderr, "create_batch: %s is not a directory\n", e->parent );
+            break;
+        }
+
+        int slot = parent_count_slot( counts, capacity, e->parent );
+        if( counts[slot].count > 0 )
+        {
+            reserve_children( parent, parent->num_children + counts[slot].count );
+            counts[slot].count = 0;
+        }
+
+        struct inode* node;
+        if( e->type == CREATE_ENTRY_DIRECTORY )
+        {
+            node = create_dir( parent, (char*)e->name );
+        }
+        else if( !pooled )
+        {
+            node = create_file( parent, (char*)e->name, e->size );
+        }
+        else
+        {
+            node = new_file_inode( (char*)e->name, e->size );
+            if( node != NULL )
+            {
+                /* The blocks belong to the file from here on; if
+                 * link_file() fails, it frees them itself.
+                 */
+                memcpy( node->blocks, &pool[next_block], node->num_blocks * sizeof(size_t) );
+                next_block += node->num_blocks;
+                node = link_file( parent, node, (char*)e->name, e->size );
+            }
+        }
+        if( node == NULL ) break;
+    }
+
+    /* Blocks that were reserved for entries after a failed one go back.
+     */
+    if( pooled && next_block < total_blocks )
+    {
+        if( free_blocks( (int)( total_blocks - next_block ), &pool[next_block] ) != 0 )
+            fprintf( stderr, "create_batch: failed to free %ld unused blocks\n", total_blocks - next_block );
+    }
+
+    journal_deferred = 0;
+    journal_sync( );
+
+    free( counts );
+    free( pool );
+    return created;
+}
+
+int create_batch_from_manifest( struct inode* root, const char* manifest )
+{
+    FILE* file = fopen( manifest, "rb" );
+    if( file == NULL )
+    {
+        fprintf( stderr, "Failed to open manifest %s\n", manifest );
+        return -1;
+    }
+
+    fseek( file, 0, SEEK_END );
+    long size = ftell( file );
+    fseek( file, 0, SEEK_SET );
+
+    char* text = malloc( size + 1 );
+    if( text == NULL || (long)fread( text, 1, size, file ) != size )
+    {
+        fprintf( stderr, "Failed to read manifest %s\n", manifest );
+        free( text );
+        fclose( file );
+        return -1;
+    }
+    fclose( file );
+    text[size] = '\0';
+
+    int num_lines = 1;
+    for( long i = 0; i < size; i++ )
+    {
+        if( text[i] == '\n' ) num_lines++;
+    }
+
+    struct create_entry* entries = malloc( num_lines * sizeof(struct create_entry) );
+    if( entries == NULL )
+    {
+        free( text );
+        return -1;
+    }
+
+    /* The lines are split in place, so the entries point into text.
+     */
+    int   num_entries = 0;
+    int   line_number = 0;
+    char* next_line   = text;
+    while( next_line != NULL )
+    {
+        /* Empty lines are counted, too, so that line numbers match */
+        char* line = next_line;
+        char* end  = strchr( line, '\n' );
+        next_line = NULL;
+        if( end != NULL )
+        {
+            *end      = '\0';
+            next_line = end + 1;
+        }
+        line_number++;
+        char* save_field;
+        char* type   = strtok_r( line, " \t\r", &save_field );
+        if( type == NULL || type[0] == '#' ) continue;
+
+        char* parent = strtok_r( NULL, " \t\r", &save_field );
+        char* name   = strtok_r( NULL, " \t\r", &save_field );
+        char* bytes  = strtok_r( NULL, " \t\r", &save_field );
+
+        struct create_entry* e = &entries[num_entries];
+        e->parent = parent;
+        e->name   = name;
+        e->size   = 0;
+        if( strcmp( type, "d" ) == 0 && parent && name && bytes == NULL )
+        {
+            e->type = CREATE_ENTRY_DIRECTORY;
+        }
+        else if( strcmp( type, "f" ) == 0 && parent && name && bytes )
+        {
+            e->type = CREATE_ENTRY_FILE;
+            e->size = atoi( bytes );
+        }
+        else
+        {
+            fprintf( stderr, "Manifest %s line %d is broken\n", manifest, line_number );
+            free( entries );
+            free( text );
+            return -1;
+        }
+        num_entries++;
+    }
+
+    int created = create_batch( root, entries, num_entries );
+    free( entries );
+    free( text );
+    return created;
+}
+
+/* Helpers for decoding the master file table. Values are stored in
+ * the byte order of the host, as save_inode() writes them.
+ */
+static int get_int( const unsigned char* buffer, long pos )
+{
+    int value;
+    memcpy( &value, &buffer[pos], sizeof(int) );
+    return value;
+}
+
+static size_t get_size( const unsigned char* buffer, long pos )
+{
+    size_t value;
+    memcpy( &value, &buffer[pos], sizeof(size_t) );
+    return value;
+}
+
+/* Return the number of bytes of the record that starts at pos in the
+ * size bytes of buffer, or -1 if the record is broken or does not
+ * fit. Only the length fields are read. *num_children is set to the
+ * number of child ids in the record.
+ */
+static long mft_record_size( const unsigned char* buffer, long size, long pos, int* num_children )
+{
+    long p = pos;
+
+    *num_children = 0;
+    if( p + 2 * (long)sizeof(int) > size ) return -1;
+    int len = get_int( buffer, p + sizeof(int) );
+    p += 2 * sizeof(int);
+    if( len < 0 || p + len + 1 > size ) return -1;
+    p += len;
+
+    char type = buffer[p];
+    p += 1;
+
+    long count_pos;
+    long header;
+    long entry;
+    switch( type )
+    {
+    case MFT_RECORD_DIRECTORY:
+        count_pos = p;
+        header    = sizeof(int);
+        entry     = sizeof(size_t);
+        break;
+    case MFT_RECORD_FILE:
+        count_pos = p + sizeof(int);
+        header    = 2 * sizeof(int);
+        entry     = sizeof(size_t);
+        break;
+    case MFT_RECORD_EXTENTS:
+        count_pos = p + 2 * sizeof(int);
+        header    = 3 * sizeof(int);
+        entry     = sizeof(size_t) + sizeof(int);
+        break;
+    case MFT_RECORD_DEAD:
+        count_pos = p;
+        header    = sizeof(int);
+        entry     = 1;
+        break;
+    default:
+        return -1;
+    }
+
+    if( p + header > size ) return -1;
+    int count = get_int( buffer, count_pos );
+    if( count < 0 || p + header + count * entry > size ) return -1;
+    p += header + count * entry;
+
+    if( type == MFT_RECORD_DIRECTORY ) *num_children = count;
+    return p - pos;
+}
+
+/* Return the type of the valid record at pos.
+ */
+static char mft_record_type( const unsigned char* buffer, long pos )
+{
+    return buffer[pos + 2 * sizeof(int) + get_int( buffer, pos + sizeof(int) )];
+}
+
+/* A hash map from inode id to inode, sized once for all inodes of
+ * the master file table. Open addressing with linear probing.
+ */
+struct id_map
+{
+    int            capacity;
+    int            count;
+    struct inode** slots;
+};
+
+static int id_map_init( struct id_map* map, int count )
+{
+    map->capacity = 16;
+    map->count    = 0;
+    while( map->capacity < count * 2 )
+        map->capacity *= 2;
+    map->slots = calloc( map->capacity, sizeof(struct inode*) );
+    return map->slots ? 0 : -1;
+}
+
+static int id_map_slot( const struct id_map* map, int id )
+{
+    int mask = map->capacity - 1;
+    int i    = ( (unsigned int)id * 2654435761u ) & mask;
+    while( map->slots[i] != NULL && map->slots[i]->id != id )
+        i = ( i + 1 ) & mask;
+    return i;
+}
+
+/* Insert node, or replace the inode with the same id. The map grows
+ * when it becomes half full. Returns -1 if memory runs out.
+ */
+static int id_map_insert( struct id_map* map, struct inode* node )
+{
+    if( ( map->count + 1 ) * 2 > map->capacity )
+    {
+        struct id_map bigger;
+        if( id_map_init( &bigger, map->count + 1 ) != 0 ) return -1;
+        for( int i = 0; i < map->capacity; i++ )
+        {
+            if( map->slots[i] )
+                bigger.slots[id_map_slot( &bigger, map->slots[i]->id )] = map->slots[i];
+        }
+        bigger.count = map->count;
+        free( map->slots );
+        *map = bigger;
+    }
+
+    int i = id_map_slot( map, node->id );
+    if( map->slots[i] == NULL ) map->count++;
+    map->slots[i] = node;
+    return 0;
+}
+
+/* Remove the inode with this id, with backward shift deletion as in
+ * dir_index_remove().
+ */
+static void id_map_remove( struct id_map* map, int id )
+{
+    int mask = map->capacity - 1;
+    int i    = id_map_slot( map, id );
+    if( map->slots[i] == NULL ) return;
+
+    map->slots[i] = NULL;
+    map->count--;
+    int j = ( i + 1 ) & mask;
+    while( map->slots[j] != NULL )
+    {
+        int home = ( (unsigned int)map->slots[j]->id * 2654435761u ) & mask;
+        if( ( ( j - home ) & mask ) >= ( ( j - i ) & mask ) )
+        {
+            map->slots[i] = map->slots[j];
+            map->slots[j] = NULL;
+            i = j;
+        }
+        j = ( j + 1 ) & mask;
+    }
+}
+
+static struct inode* id_map_find( const struct id_map* map, int id )
+{
+    return map->slots[id_map_slot( map, id )];
+}
+
+/* Decode the record at pos into a new inode. The ids of the children
+ * of a directory are copied to child_ids; the children array is
+ * filled in when all inodes exist. Returns NULL if memory runs out.
+ */
+static struct inode* decode_inode( const unsigned char* buffer, long pos, size_t* child_ids )
+{
+    int id = get_int( buffer, pos );
+    pos += sizeof(int);
+    int len = get_int( buffer, pos );
+    pos += sizeof(int);
+    const char* name = (const char*)&buffer[pos];
+    pos += len;
+
+    char type = buffer[pos];
+    pos += 1;
+
+    /* The block list or the extents are stored after the name, and so
+     * is the dir_extra of a directory. A file has at least one extent.
+     */
+    int    count     = 0;
+    size_t tail_size = sizeof(struct dir_extra);
+    if( type == MFT_RECORD_EXTENTS )
+    {
+        count = get_int( buffer, pos + 2 * sizeof(int) );
+        if( count == 0 ) return NULL;
+        tail_size = count * sizeof(struct extent);
+    }
+    else if( type != MFT_RECORD_DIRECTORY )
+    {
+        count = get_int( buffer, pos + sizeof(int) );
+        tail_size = count * sizeof(size_t);
+    }
+    if( count < 0 ) return NULL;
+
+    struct inode* node = new_inode_struct( name, strnlen( name, len ), tail_size );
+    if( node == NULL ) return NULL;
+
+    node->id = id;
+    node->name_hash = hash_name( node->name );
+
+    int ok = 1;
+    if( type == MFT_RECORD_DIRECTORY )
+    {
+        node->is_directory = 1;
+        node->num_children = get_int( buffer, pos );
+        pos += sizeof(int);
+        node->children = new_children_array( node, node->num_children );
+        ok = ( node->children != NULL );
+        for( int i = 0; i < node->num_children; i++ )
+        {
+            child_ids[i] = get_size( buffer, pos );
+            pos += sizeof(size_t);
+        }
+    }
+    else if( type == MFT_RECORD_EXTENTS )
+    {
+        node->filesize = get_int( buffer, pos );
+        node->num_blocks = get_int( buffer, pos + sizeof(int) );
+        node->num_extents = get_int( buffer, pos + 2 * sizeof(int) );
+        pos += 3 * sizeof(int);
+        node->extents = inode_tail( node );
+        for( int i = 0; i < node->num_extents; i++ )
+        {
+            node->extents[i].start = get_size( buffer, pos );
+            pos += sizeof(size_t);
+            node->extents[i].length = get_int( buffer, pos );
+            pos += sizeof(int);
+        }
+    }
+    else
+    {
+        node->filesize = get_int( buffer, pos );
+        node->num_blocks = get_int( buffer, pos + sizeof(int) );
+        pos += 2 * sizeof(int);
+        node->blocks = inode_tail( node );
+        for( int i = 0; i < node->num_blocks; i++ )
+        {
+            node->blocks[i] = get_size( buffer, pos );
+            pos += sizeof(size_t);
+        }
+    }
+
+    if( !ok )
+    {
+        free_inode_struct( node );
+        return NULL;
+    }
+    return node;
+}
+
+/* Release inodes that were decoded but not linked into a tree. Entries
+ * that were not decoded are NULL.
+ */
+static void free_unlinked_inodes( struct inode** inodes, int count )
+{
+    for( int i = 0; i < count; i++ )
+    {
+        if( inodes[i] ) free_inode_struct( inodes[i] );
+    }
+}
+
+/* The number of threads that load_inodes() uses to decode and link
+ * records, and the least number of records per thread.
+ */
+#define LOAD_RECORDS_PER_THREAD 4096
+
+static int load_threads = 1;
+
+void set_load_threads( int threads )
+{
+    load_threads = threads < 1 ? 1 : threads;
+}
+
+/* A range [lo,hi) of the records of load_mft(), for one thread.
+ * Record i starts at offsets[i], and its child ids are stored from
+ * child_ids[child_start[i]] on.
+ */
+struct load_job
+{
+    const unsigned char* buffer;
+    long                 size;
+    const long*          offsets;
+    const long*          child_start;
+    size_t*              child_ids;
+    struct inode**       inodes;
+    const struct id_map* map;
+    int                  lo;
+    int                  hi;
+    int                  failed;
+    pthread_t            thread;
+};
+
+static void* decode_records( void* arg )
+{
+    struct load_job* job = arg;
+    for( int i = job->lo; i < job->hi; i++ )
+    {
+        int           num_children;
+        long          pos  = job->offsets[i];
+        struct inode* node = decode_inode( job->buffer, pos, &job->child_ids[job->child_start[i]] );
+        if( node == NULL )
+        {
+            job->failed = 1;
+            return NULL;
+        }
+        node->mft_offset = pos;
+        node->mft_size   = mft_record_size( job->buffer, job->size, pos, &num_children );
+        job->inodes[i]   = node;
+    }
+    return NULL;
+}
+
+/* Replace the child ids of the directories in the range by pointers.
+ * The map is only read, so that ranges can be linked in parallel.
+ */
+static void* link_records( void* arg )
+{
+    struct load_job* job = arg;
+    for( int i = job->lo; i < job->hi; i++ )
+    {
+        struct inode* node = job->inodes[i];
+        if( !node->is_directory ) continue;
+
+        const size_t* ids    = &job->child_ids[job->child_start[i]];
+        int           linked = 0;
+        for( int k = 0; k < node->num_children; k++ )
+        {
+            int id = (int)ids[k];
+            struct inode* child = id_map_find( job->map, id );
+            if( child == NULL )
+            {
+                fprintf( stderr, "Inode %d refers to the unknown inode %d.\n", node->id, id );
+                continue;
+            }
+            node->children[linked++] = child;
+        }
+        node->num_children = linked;
+    }
+    return NULL;
+}
+
+/* Run fn on num_inodes records split into ranges, one per thread. The
+ * calling thread takes the first range. Returns -1 if a range failed.
+ * The arena allocator is not thread-safe, so in arena mode everything
+ * runs in the calling thread.
+ */
+static int run_load_jobs( void* (*fn)( void* ), const struct load_job* proto, int num_inodes )
+{
+    int threads = use_arena ? 1 : load_threads;
+    if( threads > num_inodes / LOAD_RECORDS_PER_THREAD )
+        threads = num_inodes / LOAD_RECORDS_PER_THREAD;
+    if( threads < 1 )
+        threads = 1;
+
+    struct load_job jobs[threads];
+    for( int t = 0; t < threads; t++ )
+    {
+        jobs[t]        = *proto;
+        jobs[t].lo     = (long)num_inodes * t / threads;
+        jobs[t].hi     = (long)num_inodes * ( t + 1 ) / threads;
+        jobs[t].failed = 0;
+    }
+
+    int started[threads];
+    for( int t = 1; t < threads; t++ )
+    {
+        started[t] = ( pthread_create( &jobs[t].thread, NULL, fn, &jobs[t] ) == 0 );
+    }
+    fn( &jobs[0] );
+
+    int failed = jobs[0].failed;
+    for( int t = 1; t < threads; t++ )
+    {
+        if( started[t] ) pthread_join( jobs[t].thread, NULL );
+        else             fn( &jobs[t] );
+        failed |= jobs[t].failed;
+    }
+    return failed ? -1 : 0;
+}
+
+/* Read the file master_file_table into a tree of inodes and return
+ * its root. map is initialized and maps the ids of all loaded inodes.
+ *
+ * The file is read in passes over an in-memory copy: the first pass
+ * only follows the length fields to find the records and count their
+ * child ids, the second one decodes every record into an inode, and
+ * the third one replaces child ids by pointers through a hash map from
+ * id to inode. The second and third pass are split over
+ * set_load_threads() threads; the map is filled in between, in file
+ * order, so the result does not depend on the number of threads.
+ */
+static struct inode* load_mft( char* master_file_table, struct id_map* map )
+{
+    FILE* file = fopen(master_file_table, "rb");
+    if(file == NULL){
+        fprintf(stderr, "load_inodes file = NULL");
+        return NULL;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long fileSize = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    unsigned char* buffer = malloc(fileSize ? fileSize : 1);
+    if (buffer == NULL) {
+        fprintf(stderr, "Failed to allocate memory for the buffer.\n");
+        fclose(file);
+        return NULL;
+    }
+
+    long bytesRead = fread(buffer, 1, fileSize, file);
+    fclose(file);
+    FS_STATS_COUNT(FS_COUNT_MFT_BYTES_READ, bytesRead);
+    if (bytesRead != fileSize) {
+        fprintf(stderr, "Failed to read the whole file.\n");
+        free(buffer);
+        return NULL;
+    }
+
+    // Pass 1: count the records and the child ids
+    int  num_inodes = 0;
+    long num_child_ids = 0;
+    for (long pos = 0; pos < fileSize; ) {
+        int  num_children;
+        long record_size = mft_record_size(buffer, fileSize, pos, &num_children);
+        if (record_size < 0) {
+            fprintf(stderr, "The master file table %s is broken at offset %ld.\n", master_file_table, pos);
+            free(buffer);
+            return NULL;
+        }
+        if (mft_record_type(buffer, pos) != MFT_RECORD_DEAD) {
+            num_inodes++;
+            num_child_ids += num_children;
+        }
+        pos += record_size;
+    }
+
+    if (num_inodes == 0) {
+        fprintf(stderr, "The master file table %s contains no inodes.\n", master_file_table);
+        free(buffer);
+        return NULL;
+    }
+
+    struct inode** inodes = calloc(num_inodes, sizeof(struct inode*));
+    size_t* child_ids = malloc((num_child_ids ? num_child_ids : 1) * sizeof(size_t));
+    long* offsets = malloc(num_inodes * sizeof(long));
+    long* child_start = malloc(num_inodes * sizeof(long));
+    if (inodes == NULL || child_ids == NULL || offsets == NULL || child_start == NULL ||
+        id_map_init(map, num_inodes) != 0) {
+        fprintf(stderr, "Failed to allocate memory for %d inodes.\n", num_inodes);
+        free(inodes);
+        free(child_ids);
+        free(offsets);
+        free(child_start);
+        free(buffer);
+        return NULL;
+    }
+
+    // Remember where the live records and their child ids start
+    long next_child_id = 0;
+    int  next_inode = 0;
+    for (long pos = 0; pos < fileSize; ) {
+        int  num_children;
+        long record_size = mft_record_size(buffer, fileSize, pos, &num_children);
+        if (mft_record_type(buffer, pos) != MFT_RECORD_DEAD) {
+            offsets[next_inode] = pos;
+            child_start[next_inode] = next_child_id;
+            next_inode++;
+            next_child_id += num_children;
+        }
+        pos += record_size;
+    }
+
+    struct load_job job = { buffer, fileSize, offsets, child_start, child_ids, inodes, map, 0, 0, 0, 0 };
+
+    // Pass 2: decode every record
+    if (run_load_jobs(decode_records, &job, num_inodes) != 0) {
+        fprintf(stderr, "Memory allocation failed\n");
+        free_unlinked_inodes(inodes, num_inodes);
+        free(map->slots);
+        free(inodes);
+        free(child_ids);
+        free(offsets);
+        free(child_start);
+        free(buffer);
+        return NULL;
+    }
+
+    for (int i = 0; i < num_inodes; i++) {
+        struct inode* node = inodes[i];
+
+        // New inodes must not reuse the ids of the loaded ones
+        if (node->id >= num_inode_ids) {
+            num_inode_ids = node->id + 1;
+        }
+
+        id_map_insert(map, node);
+    }
+
+    // Pass 3: replace the child ids by pointers
+    run_load_jobs(link_records, &job, num_inodes);
+
+    // The root is the first record, unless update_inodes() moved it to
+    // the end of the file. In that case, it is the only inode that is
+    // not the child of another one. dirty serves as the mark for this.
+    struct inode* root = inodes[0];
+    if (root->mft_offset != 0) {
+        for (int i = 0; i < num_inodes; i++) {
+            for (int k = 0; inodes[i]->is_directory && k < inodes[i]->num_children; k++) {
+                inodes[i]->children[k]->dirty = 1;
+            }
+        }
+        for (int i = num_inodes - 1; i >= 0; i--) {
+            if (!inodes[i]->dirty) root = inodes[i];
+        }
+        for (int i = 0; i < num_inodes; i++) {
+            inodes[i]->dirty = 0;
+        }
+    }
+    remember_mft(master_file_table);
+
+    free(inodes);
+    free(child_ids);
+    free(offsets);
+    free(child_start);
+    free(buffer);
+
+    return root;
+}
+
+
+/* Records are encoded into a buffer of SAVE_BUFFER_SIZE bytes that is
+ * written to the file whenever it is full, so that saving costs one
+ * write per megabyte instead of several per inode.
+ */
+#define SAVE_BUFFER_SIZE (1 << 20)
+
+struct save_buffer
+{
+    FILE*          file;
+    unsigned char* data;
+    size_t         capacity;
+    size_t         used;
+    long           written;
+    int            failed;
+};
+
+static void save_flush( struct save_buffer* out )
+{
+    if( out->used > 0 && !out->failed )
+    {
+        if( fwrite( out->data, 1, out->used, out->file ) != out->used )
+        {
+            fprintf( stderr, "Failed to write the master file table\n" );
+            out->failed = 1;
+        }
+        FS_STATS_COUNT( FS_COUNT_MFT_BYTES_WRITTEN, out->used );
+    }
+    out->written += out->used;
+    out->used = 0;
 }
 
-static int verified_delete_in_parent(struct inode* parent, struct inode* node )
+static void save_put( struct save_buffer* out, const void* data, size_t size )
 {
-    if (!parent->is_directory){
-    fprintf(stderr, "Parent inode is not a directory.\n");
-    return -1;
-    }
-    
-    for (int i = 0; i<parent->num_children; i++)
+    if( out->used + size > out->capacity )
     {
-        if (parent->children[i]->id == node->id)
+        save_flush( out );
+        if( size > out->capacity )
         {
-            return -1;
+            if( !out->failed && fwrite( data, 1, size, out->file ) != size )
+            {
+                fprintf( stderr, "Failed to write the master file table\n" );
+                out->failed = 1;
+            }
+            FS_STATS_COUNT( FS_COUNT_MFT_BYTES_WRITTEN, size );
+            out->written += size;
+            return;
         }
     }
-    return 0;
+    memcpy( &out->data[out->used], data, size );
+    out->used += size;
 }
 
-int is_node_in_parent( struct inode* parent, struct inode* node )
+/* Encode the record of a single inode. For a directory, this is only
+ * the list of child ids; the records of the children follow later.
+ */
+static void save_inode( struct save_buffer* out, struct inode* node )
 {
-    if (!parent->is_directory){
-    fprintf(stderr, "is_node_in_parent: Parent inode %s is not a directory.\n", parent->name);    return -1;
+    int len = strlen( node->name ) + 1;
+
+    char type = MFT_RECORD_FILE;
+    if( node->is_directory )  type = MFT_RECORD_DIRECTORY;
+    else if( node->num_extents ) type = MFT_RECORD_EXTENTS;
+
+    save_put( out, &node->id, sizeof(int) );
+    save_put( out, &len, sizeof(int) );
+    save_put( out, node->name, len );
+    save_put( out, &type, sizeof(char) );
+    if( node->is_directory )
+    {
+        save_put( out, &node->num_children, sizeof(int) );
+        for( int i=0; i<node->num_children; i++ )
+        {
+            size_t id = node->children[i]->id;
+            save_put( out, &id, sizeof(size_t) );
+        }
     }
-    
-    for (int i = 0; i<parent->num_children; i++)
+    else if( node->num_extents )
     {
-        if (parent->children[i]->id == node->id)
+        save_put( out, &node->filesize, sizeof(int) );
+        save_put( out, &node->num_blocks, sizeof(int) );
+        save_put( out, &node->num_extents, sizeof(int) );
+        for( int i=0; i<node->num_extents; i++ )
         {
-            return 0;
+            save_put( out, &node->extents[i].start, sizeof(size_t) );
+            save_put( out, &node->extents[i].length, sizeof(int) );
         }
     }
-    return -1;
+    else
+    {
+        save_put( out, &node->filesize, sizeof(int) );
+        save_put( out, &node->num_blocks, sizeof(int) );
+        save_put( out, node->blocks, node->num_blocks * sizeof(size_t) );
+    }
 }
 
-int delete_file( struct inode* parent, struct inode* node )
+/* A directory on the explicit stack of save_inodes(), with the index
+ * of its next child to save.
+ */
+struct save_frame
 {
-    //Det antas at parent faktisk er en directory og node er en file.
-    //Parent is a direct parent to the node, then the node can be deleted
-    if (is_node_in_parent(parent, node) == 0) // måtte sette == 0 siden vår funksjon returnerer 0 for success!
+    struct inode* dir;
+    int           next;
+};
+
+/* Encode the record of node at the end of out and remember where it
+ * is.
+ */
+static void save_record( struct save_buffer* out, struct inode* node )
+{
+    node->mft_offset = out->written + out->used;
+    save_inode( out, node );
+    node->mft_size = out->written + out->used - node->mft_offset;
+}
+
+/* Write the records of the tree below root to master_file_table.
+ * The records are written in pre-order: every inode is followed by
+ * the records of its children, each with all of its descendants.
+ * The tree is walked with an explicit stack, so that deep trees
+ * cannot overflow the call stack.
+ */
+static int write_inodes( char* master_file_table, struct inode* root )
+{
+    if( root == NULL )
     {
-        //Move to the specified location in the array where the element you want to remove is.
-        struct inode** newChildrenArray = calloc(parent->num_children-1, sizeof(struct inode*));
+        fprintf( stderr, "root inode is NULL\n" );
+        return -1;
+    }
+
+    /* The record offsets change now, and belong to no file until the
+     * caller calls remember_mft().
+     */
+    free( mft_file_name );
+    mft_file_name = NULL;
 
-	//for (int u = 0; u < parent->num_children; u++)
-	//{
-	//    printf("CHILD FØR SLETTING I delete_file: %s, ", parent->children[u]->name);
-	//}
+    FILE* file = fopen( master_file_table, "w" );
+    if( !file )
+    {
+        fprintf( stderr, "Failed to open file %s\n", master_file_table );
+        return -1;
+    }
 
-	int pos = 0;
+    struct save_buffer out = { file, malloc( SAVE_BUFFER_SIZE ), SAVE_BUFFER_SIZE, 0, 0, 0 };
+    int                capacity = 64;
+    int                depth    = 0;
+    struct save_frame* stack    = malloc( capacity * sizeof(struct save_frame) );
+    if( out.data == NULL || stack == NULL )
+    {
+        fprintf( stderr, "Failed to allocate memory to save %s\n", master_file_table );
+        free( out.data );
+        free( stack );
+        fclose( file );
+        return -1;
+    }
 
-        for (int i = 0; i < parent->num_children; i++){
-            if (parent->children[i]->id == node->id){
-                pos = i;
-                break;
-            } else 
-	    {
-	        newChildrenArray[i] = parent->children[i];
-	    }
+    save_record( &out, root );
+    if( root->is_directory )
+    {
+        stack[depth].dir  = root;
+        stack[depth].next = 0;
+        depth++;
+    }
+
+    while( depth > 0 && !out.failed )
+    {
+        struct save_frame* top = &stack[depth-1];
+        if( top->next == top->dir->num_children )
+        {
+            depth--;
+            continue;
         }
 
-        //Copy the next element to the current element of array. Which is you need to perform array[i] = array[i + 1]
-        for (int j = pos; j < parent->num_children-1; j++){
-            newChildrenArray[j] = parent->children[j+1];
+        struct inode* child = top->dir->children[top->next++];
+        save_record( &out, child );
+        if( !child->is_directory ) continue;
+
+        if( depth == capacity )
+        {
+            struct save_frame* bigger = realloc( stack, 2 * capacity * sizeof(struct save_frame) );
+            if( bigger == NULL )
+            {
+                fprintf( stderr, "Failed to allocate memory to save %s\n", master_file_table );
+                out.failed = 1;
+                break;
+            }
+            stack     = bigger;
+            capacity *= 2;
         }
+        stack[depth].dir  = child;
+        stack[depth].next = 0;
+        depth++;
+    }
 
-        parent->num_children--; // Lower increment number of children
-        free(parent->children);
-	parent->children = newChildrenArray;
+    save_flush( &out );
+    free( out.data );
+    free( stack );
+    if( fclose( file ) != 0 ) out.failed = 1;
+    return out.failed ? -1 : 0;
+}
 
+/* Write the whole table, which then holds the records of the tree.
+ */
+static int save_all( char* master_file_table, struct inode* root )
+{
+    if( write_inodes( master_file_table, root ) != 0 ) return -1;
+    remember_mft( master_file_table );
+    return 0;
+}
 
-	//for (int f = 0; f < parent->num_children; f++)
-        //{
-        //    printf("CHILD ETTER SLETTING I delete_file: %s, ", parent->children[f]->name);
-        //}
+void save_inodes( char* master_file_table, struct inode* root )
+{
+    FS_STATS_TIME( FS_OP_SAVE_INODES );
+    save_all( master_file_table, root );
+}
 
-	//Sikkerhetssjekk. Er antageligvis her verified_delete_in_parent er tenkt aa brukes.
-        if (verified_delete_in_parent(parent, node) != 0)
-        {
-            fprintf(stderr, "The node was not deleted. Function verified_delete_in_parent(parent, node) returned -1");
-            return -1;
-        }
+/* The smallest record is a dead one without a name: the id, the name
+ * length 0, the type byte and the number of bytes that follow.
+ */
+#define MFT_DEAD_SIZE ( 2 * sizeof(int) + 1 + sizeof(int) )
 
-        for (int k = 0; k < node->num_blocks; k++){
-            free_block(node->blocks[k]);
-        }
+/* The number of bytes that save_inode() writes for node.
+ */
+static int record_size_of( const struct inode* node )
+{
+    int size = 2 * sizeof(int) + strlen( node->name ) + 1 + 1;
+    if( node->is_directory )
+        return size + sizeof(int) + node->num_children * sizeof(size_t);
+    if( node->num_extents )
+        return size + 3 * sizeof(int) + node->num_extents * ( sizeof(size_t) + sizeof(int) );
+    return size + 2 * sizeof(int) + node->num_blocks * sizeof(size_t);
+}
 
-	free(node->blocks);
-        free(node->name);
-        free(node);
-    }
-    else
+/* Turn the size bytes at offset into a dead record.
+ */
+static int write_dead_record( FILE* file, long offset, int size )
+{
+    unsigned char record[MFT_DEAD_SIZE];
+    int  id   = -1;
+    int  len  = 0;
+    int  skip = size - MFT_DEAD_SIZE;
+    memcpy( &record[0], &id, sizeof(int) );
+    memcpy( &record[sizeof(int)], &len, sizeof(int) );
+    record[2 * sizeof(int)] = MFT_RECORD_DEAD;
+    memcpy( &record[2 * sizeof(int) + 1], &skip, sizeof(int) );
+
+    if( fseek( file, offset, SEEK_SET ) != 0 || fwrite( record, 1, MFT_DEAD_SIZE, file ) != MFT_DEAD_SIZE )
     {
-        fprintf(stderr, "Parent is not a direct parent of node. The node will not be deleted.");
+        fprintf( stderr, "Failed to write the master file table\n" );
         return -1;
     }
+    FS_STATS_COUNT( FS_COUNT_MFT_BYTES_WRITTEN, MFT_DEAD_SIZE );
     return 0;
-
 }
 
-int delete_dir( struct inode* parent, struct inode* node )
+int update_inodes( char* master_file_table, struct inode* root )
 {
-
-    //Det antas at begge parameterene parent og node faktisk er directories.
-    if (node->num_children != 0) // endret fra 0 til NULL
+    FS_STATS_TIME( FS_OP_UPDATE_INODES );
+    if( root == NULL )
     {
-        fprintf(stderr, "The node contains children. The node will not be deleted.\n");
+        fprintf( stderr, "root inode is NULL\n" );
         return -1;
     }
 
-    //Parent is a direct parent to the node AND the node has no children itself, then the node can be deleted
-    if (is_node_in_parent(parent, node) == 0)
+    FILE* file = NULL;
+    if( mft_file_name && strcmp( mft_file_name, master_file_table ) == 0 &&
+        root->mft_size > 0 && !dirty_overflow )
     {
-	//Move to the specified location in the array where the element you want to remove is.
-        struct inode** newChildrenArray = calloc(parent->num_children-1, sizeof(struct inode*));
+        file = fopen( master_file_table, "r+b" );
+    }
 
-        //for (int u = 0; u < parent->num_children; u++)
-        //{
-        //    printf("CHILD FØR SLETTING I delete_file: %s, ", parent->children[u]->name);
-        //}
+    unsigned char* data = malloc( SAVE_BUFFER_SIZE );
+    if( file == NULL || data == NULL )
+    {
+        if( file ) fclose( file );
+        free( data );
+        return save_all( master_file_table, root );
+    }
 
-        int pos = 0;
+    fseek( file, 0, SEEK_END );
+    long tail = ftell( file );
 
-        for (int i = 0; i < parent->num_children; i++){
-            if (parent->children[i]->id == node->id){
-                pos = i;
-                break;
-            } else
-            {
-                newChildrenArray[i] = parent->children[i];
-            }
-        }
+    /* A record that does not fit into its old place any more moves to
+     * the end of the file, and the old place becomes dead. New inodes
+     * have no place yet.
+     */
+    for( int i = 0; i < num_dirty; i++ )
+    {
+        struct inode* node = dirty_nodes[i];
+        int           size = record_size_of( node );
+        if( node->mft_size == size || node->mft_size - size >= (int)MFT_DEAD_SIZE ) continue;
 
-        //Copy the next element to the current element of array. Which is you need to perform array[i] = array[i + 1]
-        for (int j = pos; j < parent->num_children-1; j++){
-            newChildrenArray[j] = parent->children[j+1];
-        }
+        forget_record( node );
+        node->mft_size = 0;
+    }
+    if( dirty_overflow )
+    {
+        fclose( file );
+        free( data );
+        return save_all( master_file_table, root );
+    }
+
+    /* First append the moved records, then rewrite the others in place
+     * and mark the dead records.
+     */
+    struct save_buffer out = { file, data, SAVE_BUFFER_SIZE, 0, tail, 0 };
+    fseek( file, tail, SEEK_SET );
+    for( int i = 0; i < num_dirty; i++ )
+    {
+        if( dirty_nodes[i]->mft_size == 0 )
+            save_record( &out, dirty_nodes[i] );
+    }
+    save_flush( &out );
 
-        parent->num_children--; // Lower increment number of children
-        free(parent->children);
-        parent->children = newChildrenArray;
+    for( int i = 0; i < num_dirty && !out.failed; i++ )
+    {
+        struct inode* node = dirty_nodes[i];
+        if( node->mft_offset >= tail ) continue;
+
+        int size = record_size_of( node );
+        fseek( file, node->mft_offset, SEEK_SET );
+        save_inode( &out, node );
+        save_flush( &out );
+        if( node->mft_size > size && write_dead_record( file, node->mft_offset + size, node->mft_size - size ) != 0 )
+            out.failed = 1;
+        node->mft_size = size;
+    }
 
-	//Sikkerhetssjekk. Er antageligvis her verified_delete_in_parent er tenkt aa brukes.
-    	if (verified_delete_in_parent(parent, node) != 0)
-    	{
-            fprintf(stderr, "Function verified_delete_in_parent(parent, node) returned -1. The node was not deleted. ");
-            return -1;
-    	}
-	
-        free(node->name);
-	free(node->children);
-        free(node);
-        //Don't use free(node->children), because node->num_children = 0. "The number of files and directories is stored in num_children. If it is 0, children is NULL"
-        }
-    else
+    for( int i = 0; i < num_dead && !out.failed; i++ )
     {
-        fprintf(stderr, "Parent is not a direct parent to the node. The node will not be deleted.");
-        return -1;
+        if( write_dead_record( file, dead_records[i].offset, dead_records[i].size ) != 0 )
+            out.failed = 1;
     }
 
+    free( data );
+    if( fclose( file ) != 0 ) out.failed = 1;
+    if( out.failed )
+    {
+        free( mft_file_name );
+        mft_file_name = NULL;
+        return -1;
+    }
+    clear_changes( );
     return 0;
 }
 
-/* Read the file master_file_table and create an inode in memory
- * for every inode that is stored in the file. Set the pointers
- * between inodes correctly.
- * The file master_file_table remains unchanged.
+/* The journal. While journal_name is set, every successful create and
+ * delete appends one record to journal_file:
+ *
+ *   JOURNAL_CREATE, parent id (int, -1 for a root), MFT record
+ *   JOURNAL_DELETE, parent id (int), id (int)
+ *   JOURNAL_DELETE_TREE, parent id (int), id (int)
+ *
+ * The MFT record of a new inode is encoded by save_inode(), so that
+ * its blocks are recorded as they were allocated. Replay never
+ * allocates or frees blocks, because the block allocation table
+ * already holds the result of every journaled operation.
  */
+#define JOURNAL_CREATE 1
+#define JOURNAL_DELETE 2
+#define JOURNAL_DELETE_TREE 3
 
-struct inode* load_inodes( char* master_file_table ){
-    // open file
-    FILE* file = fopen(master_file_table, "rb");
-    if(file == NULL){
-        fprintf(stderr, "load_inodes file = NULL");
-        return NULL;
+#define JOURNAL_BUFFER_SIZE 4096
+
+static char* journal_name = NULL;
+static FILE* journal_file = NULL;
+
+int set_journal_name( char* name )
+{
+    if( journal_file )
+    {
+        fclose( journal_file );
+        journal_file = NULL;
     }
+    free( journal_name );
+    journal_name = NULL;
 
-    struct inode** inodeBeholder = calloc(1, sizeof(struct inode*));
-    if (inodeBeholder == NULL) {
-        printf("%s", "inodeBeholder == NULL");
-        return NULL;
+    if( name == NULL ) return 0;
+
+    journal_file = fopen( name, "ab" );
+    if( journal_file == NULL )
+    {
+        fprintf( stderr, "Failed to open journal %s\n", name );
+        return -1;
     }
-    
-	*inodeBeholder = NULL;  // initialized to NULL
-	
-    int antNoder = 0;
+    journal_name = strdup( name );
+    return 0;
+}
 
-    //Create buffer for file which we will actually use
-    fseek(file, 0, SEEK_END);
-    int fileSize = ftell(file);
-    fseek(file, 0, SEEK_SET);
+/* Append one record, and hand it to the operating system before the
+ * operation returns.
+ */
+static void journal_append( char op, struct inode* parent, struct inode* node )
+{
+    if( journal_file == NULL ) return;
 
-    unsigned char* buffer = calloc(fileSize, sizeof(unsigned char));
+    unsigned char      data[JOURNAL_BUFFER_SIZE];
+    struct save_buffer out = { journal_file, data, JOURNAL_BUFFER_SIZE, 0, 0, 0 };
+    int                parent_id = parent ? parent->id : -1;
 
-    if (buffer == NULL) {
-        fprintf(stderr, "Failed to allocate memory for the buffer.\n");
-        fclose(file);
-        return NULL;
-    }
+    pthread_mutex_lock( &journal_lock );
+    save_put( &out, &op, sizeof(char) );
+    save_put( &out, &parent_id, sizeof(int) );
+    if( op == JOURNAL_CREATE )
+        save_inode( &out, node );
+    else
+        save_put( &out, &node->id, sizeof(int) );
+    save_flush( &out );
 
-    int bytesRead = fread(buffer, 1, fileSize, file);
+    if( !journal_deferred && fflush( journal_file ) != 0 )
+        fprintf( stderr, "Failed to write journal %s\n", journal_name );
+    pthread_mutex_unlock( &journal_lock );
+}
 
-    if (bytesRead != fileSize) {
-        fprintf(stderr, "Failed to read the whole file.\n");
-        fclose(file);
-        free(buffer);
-        return NULL;
-    }
+static void journal_sync( )
+{
+    if( journal_file && fflush( journal_file ) != 0 )
+        fprintf( stderr, "Failed to write journal %s\n", journal_name );
+}
 
-    fclose(file);
+static void journal_create( struct inode* parent, struct inode* node )
+{
+    journal_append( JOURNAL_CREATE, parent, node );
+}
 
-    int bytesProcessed = 0;
-	int teller = 0;
-    while (bytesProcessed < fileSize){
-    	teller++;
-        struct inode* new_inode = calloc(1, sizeof(struct inode));
-        
-        new_inode->id = (int)(buffer[bytesProcessed]) | (buffer[bytesProcessed+1]) | (buffer[bytesProcessed+2]) | buffer[bytesProcessed+3];
-        bytesProcessed += 4;
-        
-        int len = (int)((buffer[bytesProcessed]) | (buffer[bytesProcessed+1]) | (buffer[bytesProcessed+2]) | buffer[bytesProcessed+3]);
-        bytesProcessed += 4;
-        new_inode->name = calloc(len, sizeof(char));
-        
-        for (int o = 0; o < len; o++){
-            int intFromBuffer = (int)buffer[bytesProcessed];
-            new_inode->name[o] = (char)intFromBuffer;
-            bytesProcessed += 1;
-        }
-        
-        int dirFlag = (int)buffer[bytesProcessed];
-        if (dirFlag == 1)
-        {
-	        new_inode->is_directory = '\x01';
-        } else 
-	    {
-	        new_inode->is_directory = '\0';
-	    }
-        
-        bytesProcessed += 1;
-
-        if (new_inode->is_directory) {
-            new_inode->num_children = (int)(buffer[bytesProcessed]) | (buffer[bytesProcessed+1]) | (buffer[bytesProcessed+2]) | buffer[bytesProcessed+3];
-            bytesProcessed += 4;
-            new_inode->children = calloc(new_inode->num_children, sizeof(struct inode*));
-
-            for ( int i = 0; i < new_inode->num_children; i++) {
-                struct inode* filler = calloc(1, sizeof(struct inode));
-                
-                filler->id = (int)(buffer[bytesProcessed]) | (buffer[bytesProcessed+1]) | (buffer[bytesProcessed+2]) | buffer[bytesProcessed+3] | (buffer[bytesProcessed+4]) | (buffer[bytesProcessed+5]) | buffer[bytesProcessed+6] | (buffer[bytesProcessed+7]);
-   				
-                bytesProcessed += 8;
-                new_inode->children[i] = filler;
-				
-                new_inode->filesize = 0;
-                new_inode->num_blocks = 0;
-                new_inode->blocks = NULL;
-            }
-        } else {
-            new_inode->filesize = (buffer[bytesProcessed+3] << 24) | 
-                                 (buffer[bytesProcessed +2 ] << 16) | 
-                                 (buffer[bytesProcessed + 1] << 8)  | 
-                                 buffer[bytesProcessed];
-           
-            bytesProcessed += 4;
-            
-            new_inode->num_blocks = (int)(buffer[bytesProcessed]) | (buffer[bytesProcessed+1]) | (buffer[bytesProcessed+2]) | buffer[bytesProcessed+3];
-            bytesProcessed += 4;
-            new_inode->blocks = calloc(new_inode->num_blocks, sizeof(size_t));
-
-            for (int t = 0; t < new_inode->num_blocks; t++){
-                new_inode->blocks[t] = (size_t)(buffer[bytesProcessed]) | (buffer[bytesProcessed+1]) | (buffer[bytesProcessed+2]) | buffer[bytesProcessed+3] | (buffer[bytesProcessed+4]) | (buffer[bytesProcessed+5]) | buffer[bytesProcessed+6] | (buffer[bytesProcessed+7]);
-                bytesProcessed += 8;
-            }
-            new_inode->num_children = 0;
-            new_inode->children = NULL;
-        }
+static void journal_delete( struct inode* parent, struct inode* node )
+{
+    journal_append( JOURNAL_DELETE, parent, node );
+}
+
+static void journal_delete_tree( struct inode* parent, struct inode* node )
+{
+    journal_append( JOURNAL_DELETE_TREE, parent, node );
+}
+
+/* Apply one create record. Records for ids that exist already are
+ * skipped, so that a journal can be replayed over a master file table
+ * that includes some of its changes.
+ */
+static void replay_create( struct inode** root, struct id_map* map, int parent_id,
+                           const unsigned char* buffer, long pos )
+{
+    if( mft_record_type( buffer, pos ) == MFT_RECORD_DEAD ) return;
+
+    size_t        no_children;
+    struct inode* node = decode_inode( buffer, pos, &no_children );
+    if( node == NULL ) return;
+
+    struct inode* parent = NULL;
+    if( id_map_find( map, node->id ) != NULL ||
+        ( parent_id < 0 && *root != NULL ) ||
+        ( parent_id >= 0 && ( ( parent = id_map_find( map, parent_id ) ) == NULL || !parent->is_directory ) ) )
+    {
+        free_inode_struct( node );
+        return;
+    }
 
-        antNoder++;
-        inodeBeholder = realloc(inodeBeholder, sizeof(struct inode*) * antNoder);
-        inodeBeholder[antNoder-1] = new_inode;
+    if( id_map_insert( map, node ) != 0 || ( parent && append_child( parent, node ) != 0 ) )
+    {
+        fprintf( stderr, "Memory allocation failed\n" );
+        id_map_remove( map, node->id );
+        free_inode_struct( node );
+        return;
     }
+    if( parent ) dir_index_insert( parent, parent->num_children - 1 );
+    else         *root = node;
+    mark_dirty( parent );
+    mark_dirty( node );
+
+    if( node->id >= num_inode_ids ) num_inode_ids = node->id + 1;
+}
 
-    for (int i = 0; i < antNoder; i++) {
-        struct inode * iNode = inodeBeholder[i];
+/* Apply one delete record. Like delete_dir(), a directory that still
+ * has children is not deleted.
+ */
+static void replay_delete( struct id_map* map, int parent_id, int id )
+{
+    struct inode* parent = id_map_find( map, parent_id );
+    struct inode* node   = id_map_find( map, id );
+    if( parent == NULL || node == NULL || !parent->is_directory ) return;
+    if( node->is_directory && node->num_children != 0 ) return;
 
-        if (iNode->is_directory && iNode-> num_children > 0){
-            set_pointer(iNode, inodeBeholder, antNoder);
+    for( int i = 0; i < parent->num_children; i++ )
+    {
+        if( parent->children[i] == node )
+        {
+            remove_child( parent, i );
+            id_map_remove( map, id );
+            mark_dirty( parent );
+            forget_record( node );
+            free_inode_struct( node );
+            return;
         }
     }
-    
-    struct inode* rootOrig = inodeBeholder[0];
-    
-    //printf("THIS IS THE NAME OF ROOT ORIG: %s\n", rootOrig->name);
-    free(inodeBeholder);
-    free(buffer);
-    //print_names_of_inodes(rootOrig);
-    //liksom_debug_fs(rootOrig);
-    
-    return rootOrig;
 }
 
+/* Apply one delete record of delete_tree(): node and everything below
+ * it are removed.
+ */
+static void replay_delete_tree( struct id_map* map, int parent_id, int id )
+{
+    struct inode* parent = id_map_find( map, parent_id );
+    struct inode* node   = id_map_find( map, id );
+    if( parent == NULL || node == NULL || !parent->is_directory ) return;
+
+    for( int i = 0; i < parent->num_children; i++ )
+    {
+        if( parent->children[i] == node )
+        {
+            int            count;
+            struct inode** nodes = collect_subtree( node, &count );
+            if( nodes == NULL )
+            {
+                fprintf( stderr, "Memory allocation failed\n" );
+                return;
+            }
+            remove_child( parent, i );
+            mark_dirty( parent );
+            for( int k = 0; k < count; k++ )
+            {
+                id_map_remove( map, nodes[k]->id );
+                forget_record( nodes[k] );
+                free_inode_struct( nodes[k] );
+            }
+            free( nodes );
+            return;
+        }
+    }
+}
 
-/* The function save_inode is a recursive functions that is
- * called by save_inodes to store a single inode on disk,
- * and call itself recursively for every child if the node
- * itself is a directory.
+/* Apply all records of the journal to the tree *root. A record that
+ * is cut off, for example by a crash while it was written, ends the
+ * replay.
  */
-static void save_inode( FILE* file, struct inode* node )
+static void replay_journal( struct inode** root, struct id_map* map )
 {
-    if( !node ) return;
+    if( journal_file ) fflush( journal_file );
 
-    int len = strlen( node->name ) + 1;
+    FILE* file = fopen( journal_name, "rb" );
+    if( file == NULL ) return;
 
-    fwrite( &node->id, 1, sizeof(int), file );
-    fwrite( &len, 1, sizeof(int), file );
-    fwrite( node->name, 1, len, file );
-    fwrite( &node->is_directory, 1, sizeof(char), file );
-    if( node->is_directory )
+    fseek( file, 0, SEEK_END );
+    long size = ftell( file );
+    fseek( file, 0, SEEK_SET );
+
+    unsigned char* buffer = malloc( size ? size : 1 );
+    if( buffer == NULL || (long)fread( buffer, 1, size, file ) != size )
     {
-        fwrite( &node->num_children, 1, sizeof(int), file );
-        for( int i=0; i<node->num_children; i++ )
+        fprintf( stderr, "Failed to read journal %s\n", journal_name );
+        free( buffer );
+        fclose( file );
+        return;
+    }
+    fclose( file );
+    FS_STATS_COUNT( FS_COUNT_MFT_BYTES_READ, size );
+
+    long pos = 0;
+    while( pos < size )
+    {
+        long header = 1 + sizeof(int);
+        if( pos + header > size ) break;
+        char op        = buffer[pos];
+        int  parent_id = get_int( buffer, pos + 1 );
+
+        if( op == JOURNAL_CREATE )
         {
-            struct inode* child = node->children[i];
-            size_t id = child->id;
-            fwrite( &id, 1, sizeof(size_t), file );
+            int  num_children;
+            long record_size = mft_record_size( buffer, size, pos + header, &num_children );
+            if( record_size < 0 || num_children != 0 ) break;
+            replay_create( root, map, parent_id, buffer, pos + header );
+            pos += header + record_size;
         }
-
-        for( int i=0; i<node->num_children; i++ )
+        else if( op == JOURNAL_DELETE || op == JOURNAL_DELETE_TREE )
         {
-            struct inode* child = node->children[i];
-            save_inode( file, child );
+            if( pos + header + (long)sizeof(int) > size ) break;
+            if( op == JOURNAL_DELETE )
+                replay_delete( map, parent_id, get_int( buffer, pos + header ) );
+            else
+                replay_delete_tree( map, parent_id, get_int( buffer, pos + header ) );
+            pos += header + sizeof(int);
         }
-    }
-    else
-    {
-        fwrite( &node->filesize, 1, sizeof(int), file );
-        fwrite( &node->num_blocks, 1, sizeof(int), file );
-        for( int i=0; i<node->num_blocks; i++ )
+        else
         {
-            fwrite( &node->blocks[i], 1, sizeof(size_t), file );
+            break;
         }
     }
+    if( pos < size )
+    {
+        fprintf( stderr, "The journal %s is broken at offset %ld; the rest is ignored.\n", journal_name, pos );
+    }
+    free( buffer );
 }
 
-void save_inodes( char* master_file_table, struct inode* root )
+/* Read the file master_file_table and create an inode in memory
+ * for every inode that is stored in the file. Set the pointers
+ * between inodes correctly. If a journal is set, its records are
+ * applied afterwards; the master file table may then be missing or
+ * empty, and the tree comes from the journal alone.
+ * The file master_file_table remains unchanged.
+ */
+struct inode* load_inodes( char* master_file_table )
 {
-    if( root == NULL )
+    FS_STATS_TIME( FS_OP_LOAD_INODES );
+    struct id_map map;
+    struct inode* root = NULL;
+
+    FILE* file = fopen( master_file_table, "rb" );
+    long  size = 0;
+    if( file )
     {
-        fprintf( stderr, "root inode is NULL\n" );
-        return;
+        fseek( file, 0, SEEK_END );
+        size = ftell( file );
+        fclose( file );
     }
 
-    FILE* file = fopen( master_file_table, "w" );
-    if( !file )
+    if( journal_name != NULL && size == 0 )
     {
-        fprintf( stderr, "Failed to open file %s\n", master_file_table );
-        return;
+        if( id_map_init( &map, 0 ) != 0 ) return NULL;
+    }
+    else
+    {
+        root = load_mft( master_file_table, &map );
+        if( root == NULL ) return NULL;
     }
 
-    save_inode( file, root );
+    if( journal_name != NULL )
+    {
+        replay_journal( &root, &map );
+    }
 
-    fclose( file );
+    dentry_cache_clear( );
+    free( map.slots );
+    if( root ) live_roots++;
+    return root;
+}
+
+int checkpoint_inodes( char* master_file_table, struct inode* root )
+{
+    size_t len = strlen( master_file_table );
+    char*  tmp = malloc( len + 5 );
+    if( tmp == NULL ) return -1;
+    memcpy( tmp, master_file_table, len );
+    memcpy( tmp + len, ".tmp", 5 );
+
+    /* Write the new table next to the old one and rename it, so that
+     * a crash leaves either the old table and the whole journal, or
+     * the new table and a journal whose records are all in it.
+     */
+    if( write_inodes( tmp, root ) != 0 || rename( tmp, master_file_table ) != 0 )
+    {
+        fprintf( stderr, "Failed to replace %s\n", master_file_table );
+        remove( tmp );
+        free( tmp );
+        return -1;
+    }
+    free( tmp );
+    remember_mft( master_file_table );
+
+    if( journal_file )
+    {
+        fflush( journal_file );
+        if( ftruncate( fileno( journal_file ), 0 ) != 0 )
+        {
+            fprintf( stderr, "Failed to truncate journal %s\n", journal_name );
+            return -1;
+        }
+    }
+    return 0;
 }
 
 /* This static variable is used to change the indentation while debug_fs
@@ -585,17 +2887,20 @@ void debug_fs( struct inode* node )
     else
     {
         printf("%s (id %d size %db blocks ", node->name, node->id, node->filesize );
-        for( int i=0; i<node->num_blocks; i++ )
+        struct block_iterator it;
+        size_t block;
+        block_iterator_init( &it, node );
+        while( block_iterator_next( &it, &block ) )
         {
-            printf("%d ", (int)node->blocks[i]);
+            printf("%d ", (int)block);
         }
         printf(")\n");
     }
 }
 
-/* Do not change.
+/* Release inode and everything below it.
  */
-void fs_shutdown( struct inode* inode )
+static void free_tree( struct inode* inode )
 {
     if( !inode ) return;
 
@@ -603,13 +2908,33 @@ void fs_shutdown( struct inode* inode )
     {
         for( int i=0; i<inode->num_children; i++ )
         {
-            fs_shutdown( inode->children[i] );
+            free_tree( inode->children[i] );
         }
     }
 
-    if( inode->name )     free( inode->name );
-    if( inode->children ) free( inode->children );
-    if( inode->blocks )   free( inode->blocks );
-    free( inode );
+    free_inode_struct( inode );
+}
+
+/* Do not change.
+ */
+void fs_shutdown( struct inode* inode )
+{
+    if( inode ) live_roots--;
+
+    /* The last tree, and nothing in it came from malloc: all dirty
+     * inodes are in the tree, and the arena goes as a whole.
+     */
+    if( inode && inode->in_arena && live_roots == 0 && live_heap_inodes == 0 )
+    {
+        num_dirty = 0;
+        release_arena( );
+    }
+    else
+    {
+        free_tree( inode );
+    }
+
+    /* Once for the whole tree, so that the generation moves slowly */
+    dentry_cache_clear( );
 }
 
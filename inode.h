@@ -5,6 +5,12 @@
 #include <stdlib.h>
 #include <string.h>
 
+/* The number of bytes in a block. A file of size bytes gets
+ * size / BLOCKSIZE + 1 blocks.
+ * Do not change.
+ */
+#define BLOCKSIZE 4096
+
 /* This is the inode structure as described in the
  * assignment.
  * It is mostly straightforward, but keep in mind
@@ -12,27 +18,166 @@
  * contains values that you must interpret as pointers
  * when is_directory==1 and that you must interpret
  * as block numbers when is_directory==0.
+ *
+ * The fields that only a directory or only a file uses share their
+ * memory: children must only be used when is_directory==1, blocks and
+ * extents only when is_directory==0. A file uses extents if
+ * num_extents is not 0, and blocks otherwise.
+ * num_children is 0 for a file, and filesize and num_blocks are 0 for
+ * a directory.
+ * An inode is a single allocation. The name is stored at its end,
+ * and the block list or the extents of a file follow the name unless
+ * they were allocated separately. A directory keeps its children in
+ * an array of its own, because it grows.
  */
 struct inode
 {
 	int            id;
-	char*          name;
-	char           is_directory;
+    unsigned int   name_hash; /* caches the hash of name */
 
 	int            num_children;
-	struct inode** children;
+    union
+    {
+        int        children_capacity; /* entries allocated in children */
+        int        num_extents;
+    };
 
 	int            filesize;
     int            num_blocks;
-    size_t*        blocks;
+
+    /* The place of the record of the inode in the master file table
+     * that was loaded or saved last; mft_size is 0 if there is none.
+     * dirty is not 0 while the record must be written again by
+     * update_inodes().
+     */
+    int            mft_size;
+    int            dirty;
+    long           mft_offset;
+
+    /* A file stores its blocks either in blocks, one entry per block,
+     * or in extents, one entry per run of consecutive blocks.
+     * num_blocks is the number of blocks in both cases. Use a
+     * block_iterator to visit the blocks of a file without caring
+     * about the representation.
+     */
+    union
+    {
+        struct inode** children;
+        size_t*        blocks;
+        struct extent* extents;
+    };
+
+	char           is_directory;
+
+    /* in_arena is not 0 if the inode, its name and its arrays live in
+     * the arena of set_inode_arena(), and 0 if they come from malloc.
+     */
+    char           in_arena;
+
+    char           name[];
+};
+
+/* A run of length consecutive blocks starting at block start.
+ */
+struct extent
+{
+    size_t start;
+    int    length;
 };
 
+/* Layouts for set_file_layout().
+ * FILE_LAYOUT_BLOCKS keeps one block number per block of a file.
+ * FILE_LAYOUT_EXTENTS allocates the blocks of a new file as
+ * contiguously as possible and keeps them as extents.
+ */
+#define FILE_LAYOUT_BLOCKS  0
+#define FILE_LAYOUT_EXTENTS 1
+
+/* Record types in the master file table. The type is stored in
+ * the byte that follows the name of an inode.
+ * MFT_RECORD_FILE is followed by the file size, the number of
+ * blocks and one size_t per block.
+ * MFT_RECORD_DIRECTORY is followed by the number of children and
+ * one size_t id per child.
+ * MFT_RECORD_EXTENTS is followed by the file size, the number of
+ * blocks, the number of extents and a size_t start and an int length
+ * per extent.
+ * MFT_RECORD_DEAD marks a record that update_inodes() replaced. Its
+ * name is empty, and it is followed by the number of bytes after that
+ * number that belong to it. Loading skips it.
+ */
+#define MFT_RECORD_FILE      0
+#define MFT_RECORD_DIRECTORY 1
+#define MFT_RECORD_EXTENTS   2
+#define MFT_RECORD_DEAD      3
+
+/* Visits the blocks of a file in order, for both the block list
+ * and the extent representation.
+ *
+ *   struct block_iterator it;
+ *   size_t block;
+ *   block_iterator_init( &it, node );
+ *   while( block_iterator_next( &it, &block ) ) { ... }
+ */
+struct block_iterator
+{
+    const struct inode* node;
+    int                 index;
+    int                 extent;
+    int                 offset;
+};
+
+void block_iterator_init( struct block_iterator* it, const struct inode* node );
+
+/* Store the next block of the file in block and return 1, or
+ * return 0 when all blocks have been visited.
+ */
+int block_iterator_next( struct block_iterator* it, size_t* block );
+
+/* Select how create_file() stores the blocks of new files,
+ * FILE_LAYOUT_BLOCKS (the default) or FILE_LAYOUT_EXTENTS.
+ * Files with extents are saved as MFT_RECORD_EXTENTS records.
+ */
+void set_file_layout( int layout );
+
+/* Enable (1) or disable (0, the default) the arena mode.
+ * Inodes that are created by create_file(), create_dir() and
+ * load_inodes() while the arena mode is enabled are taken from
+ * fixed-size slabs, and their names and arrays from large shared
+ * regions, instead of several mallocs per inode. The regions are
+ * released together when the last of these inodes is deleted or
+ * released by fs_shutdown(). Trees may mix both kinds of inodes.
+ * fs_shutdown() of the last tree releases the regions without
+ * visiting the inodes, unless some inodes came from malloc.
+ */
+void set_inode_arena( int enable );
+
+/* Enable (1) or disable (0, the default) the concurrent mode.
+ * In this mode, create_file(), create_dir(), delete_file(),
+ * delete_dir(), delete_tree(), find_inode_by_name() and
+ * lookup_path() may be called from several threads at once.
+ * Every directory has a reader/writer lock: lookups take it for
+ * reading, so lookups scale across threads, and changes take it for
+ * writing, so a writer only blocks its own directory. Inode ids are
+ * taken from an atomic counter.
+ * The caller must make sure that no thread uses an inode while
+ * another one deletes it, and the block allocation table must be in
+ * BAT_MODE_CONCURRENT. lookup_path() does not use its cache, and the
+ * next update_inodes() writes the whole table. All other functions
+ * must not run concurrently with any of these. The arena mode cannot
+ * be combined with this mode.
+ * Returns 0 in case of success and -1 if inodes of the arena mode
+ * exist.
+ */
+int set_inode_concurrency( int enable );
+
 /* Create a file below the inode parent. Parent must
  * be a directory. The size of the file is size_in_bytes,
- * and create_file calls the allocate_block() function
- * enough number of times to reserve blocks in the simulated
- * disk to store all of these bytes.
- * Returns a pointer to file's inodes.
+ * and create_file calls the allocate_blocks() function
+ * to reserve enough blocks in the simulated disk to store
+ * all of these bytes.
+ * Returns a pointer to file's inodes, or NULL if the disk
+ * is full. In that case, no blocks stay allocated.
  */
 struct inode* create_file( struct inode* parent, char* name, int size_in_bytes );
 
@@ -46,12 +191,84 @@ struct inode* create_dir( struct inode* parent, char* name );
  * the node parent. If one of them has the name "name",
  * its inode pointer is returned.
  * parent must be directory.
+ * Directories with at least DIR_INDEX_THRESHOLD children
+ * are searched through a hash index instead of one by one.
  */
+#define DIR_INDEX_THRESHOLD 32
+
 struct inode* find_inode_by_name( struct inode* parent, char* name );
 
+/* Follow the absolute or relative path from the directory root,
+ * e.g. "/usr/local/bin/gcc", and return the inode it names, or
+ * NULL if there is no such inode. Empty components are ignored,
+ * so "/" returns root.
+ * Every step goes through a bounded cache of (directory, name)
+ * pairs that also remembers names that were not found. Creating
+ * and deleting files and directories invalidates the affected
+ * entries.
+ */
+struct inode* lookup_path( struct inode* root, const char* path );
+
+/* Drop all entries from the cache used by lookup_path().
+ * load_inodes() and fs_shutdown() do this automatically.
+ */
+void dentry_cache_clear( );
+
+/* An entry for create_batch(). parent is the path of the directory
+ * below which name is created, as in lookup_path(). size is the size
+ * in bytes of a file and ignored for a directory.
+ */
+#define CREATE_ENTRY_FILE      0
+#define CREATE_ENTRY_DIRECTORY 1
+
+struct create_entry
+{
+    const char* parent;
+    const char* name;
+    int         type;
+    int         size;
+};
+
+/* Create the files and directories of entries in order below root,
+ * with the same ids, blocks and order of children that one
+ * create_file() or create_dir() call per entry would give. A parent
+ * may be created by an earlier entry. The blocks of all files are
+ * allocated in one pass over the block allocation table, the children
+ * array of every parent grows at most once, and journal records are
+ * written together at the end.
+ * Processing stops at the first entry whose parent is not a directory,
+ * or whose file does not fit with FILE_LAYOUT_EXTENTS. Returns the
+ * number of entries that were created. With FILE_LAYOUT_BLOCKS, it
+ * returns -1 and creates nothing if the disk has no room for all files.
+ */
+int create_batch( struct inode* root, const struct create_entry* entries, int num_entries );
+
+/* Call create_batch() with the entries of the text file manifest,
+ * one per line:
+ *
+ *   d PARENT NAME
+ *   f PARENT NAME SIZE
+ *
+ * Fields are separated by blanks; empty lines and lines starting with
+ * # are skipped. Returns -1 if the manifest is broken.
+ */
+int create_batch_from_manifest( struct inode* root, const char* manifest );
+
+/* Ways for delete_file() and delete_dir() to close the gap in the
+ * children array of the parent.
+ * CHILD_REMOVAL_SHIFT (the default) moves all later children one
+ * position down and keeps their order.
+ * CHILD_REMOVAL_SWAP moves the last child into the gap, which takes
+ * constant time but changes the order of the children.
+ */
+#define CHILD_REMOVAL_SHIFT 0
+#define CHILD_REMOVAL_SWAP  1
+
+void set_child_removal( int removal );
+
 /* Delete the file given by its inode, if it is an inode
  * directly referenced by parent.
- * The function calls free_block for every block that is
+ * The function calls free_blocks for the blocks that are
  * referenced by this file. This removes those blocks from
  * simulate disk.
  */
@@ -64,19 +281,71 @@ int delete_file( struct inode* parent, struct inode* node );
  */
 int delete_dir( struct inode* parent, struct inode* node );
 
+/* Delete node, which may be a file or a non-empty directory, and
+ * everything below it, if node is directly referenced by parent.
+ * The subtree is detached from parent in one step, the blocks of
+ * all its files are released with a single free_blocks call, and
+ * the inodes are freed without recursion. With a journal set, the
+ * whole deletion is one journal record.
+ * Returns 0 in case of success and -1 in case of an error.
+ */
+int delete_tree( struct inode* parent, struct inode* node );
+
 /* Write the given inode root and all inodes referenced by it
  * to the file called superblock, following the oblig instructions.
  * No inodes are changed.
  */
 void save_inodes( char* master_file_table, struct inode* root );
 
+/* Write the changes to the tree below root since it was loaded from
+ * or saved to master_file_table. Only the records of inodes that were
+ * created, and of directories whose children changed, are written: in
+ * place if they still fit, or else at the end of the file. The records
+ * of deleted inodes and the old places of moved ones become dead
+ * records. If master_file_table is not the file that was loaded or
+ * saved last, the whole tree is written like save_inodes() does.
+ * Loading or saving another tree forgets the changes made so far.
+ * Dead records take space until save_inodes() rewrites the file.
+ * The update is not atomic; use a journal to survive crashes.
+ * Returns 0 in case of success and -1 in case of an error.
+ */
+int update_inodes( char* master_file_table, struct inode* root );
+
 /* Read the file master_file_table and create an inode in memory
  * for every inode that is stored in the file. Set the pointers
  * between inodes correctly.
+ * If a journal is set, its records are applied to the loaded tree.
+ * In that case, master_file_table may be missing or empty, and the
+ * whole tree comes from the journal.
  * The file master_file_table remains unchanged.
  */
 struct inode* load_inodes( char* master_file_table );
 
+/* Set the number of threads that load_inodes() uses to decode the
+ * records of the master file table and to link them into a tree.
+ * The default is 1. Small tables and the arena mode are always
+ * loaded by the calling thread alone. The loaded tree is the same
+ * for every number of threads.
+ */
+void set_load_threads( int threads );
+
+/* Set the name of a journal file, or NULL to stop journaling.
+ * While a journal is set, create_file(), create_dir(), delete_file()
+ * and delete_dir() append one small record to it, so that a change
+ * is persisted without rewriting the master file table, and
+ * load_inodes() replays the journal on top of the table.
+ * Records that are already part of the table are skipped on replay.
+ * Returns 0 in case of success and -1 if the file cannot be opened.
+ */
+int set_journal_name( char* journal );
+
+/* Write the tree below root to master_file_table like save_inodes(),
+ * replacing the old file only once the new one is complete, and then
+ * empty the journal.
+ * Returns 0 in case of success and -1 in case of an error.
+ */
+int checkpoint_inodes( char* master_file_table, struct inode* root );
+
 /* This function is handed out.
  *
  * It releases all dynamically allocated memory.
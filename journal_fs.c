@@ -0,0 +1,131 @@
+#include "inode.h"
+#include "allocation.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/* Count the inodes that differ between two trees. Ids, names, sizes
+ * and blocks must all be the same.
+ */
+static int compare_trees( struct inode* a, struct inode* b )
+{
+    if( a == NULL || b == NULL ) return !( a == NULL && b == NULL );
+
+    if( a->id != b->id || strcmp( a->name, b->name ) != 0 ||
+        a->is_directory != b->is_directory )
+        return 1;
+
+    if( !a->is_directory )
+    {
+        if( a->filesize != b->filesize || a->num_blocks != b->num_blocks ) return 1;
+
+        struct block_iterator it_a;
+        struct block_iterator it_b;
+        size_t block_a;
+        size_t block_b;
+        block_iterator_init( &it_a, a );
+        block_iterator_init( &it_b, b );
+        while( block_iterator_next( &it_a, &block_a ) )
+        {
+            if( !block_iterator_next( &it_b, &block_b ) || block_a != block_b ) return 1;
+        }
+        return 0;
+    }
+
+    if( a->num_children != b->num_children ) return 1;
+
+    int differences = 0;
+    for( int i = 0; i < a->num_children; i++ )
+    {
+        differences += compare_trees( a->children[i], b->children[i] );
+    }
+    return differences;
+}
+
+static long file_size( char* name )
+{
+    struct stat st;
+    if( stat( name, &st ) != 0 ) return -1;
+    return st.st_size;
+}
+
+/* Load the MFT, which replays the journal, and print how many inodes
+ * differ from expected.
+ */
+static struct inode* replay( const char* what, char* mft_name, struct inode* expected )
+{
+    struct inode* loaded = load_inodes( mft_name );
+    printf("%-44s %d inodes differ\n", what, compare_trees( expected, loaded ) );
+    return loaded;
+}
+
+int main( int argc, char* argv[] )
+{
+    if( argc != 4 )
+    {
+        fprintf( stderr, "This program creates a small file system and saves it to the master file\n"
+                         "table (MFT). Further changes are only written to the journal. The MFT is\n"
+                         "loaded again after each step, which replays the journal, and the loaded\n"
+                         "tree is compared with the tree in memory: over the older MFT, over an MFT\n"
+                         "that has the changes already, with a cut off last record, and after\n"
+                         "checkpoint_inodes().\n"
+                         "\n"
+                         "Usage: %s MFT BAT JOURNAL\n"
+                         "       where\n"
+                         "       MFT is the name of the master file table\n"
+                         "       BAT is the name of the block allocation table\n"
+                         "       JOURNAL is the name of the journal\n"
+                         , argv[0] );
+        exit( -1 );
+    }
+
+    char* mft_name     = argv[1];
+    char* bat_name     = argv[2];
+    char* journal_name = argv[3];
+
+    set_block_allocation_table_name( bat_name );
+    format_disk();
+    remove( journal_name );
+
+    struct inode* root    = create_dir( NULL, "/" );
+    struct inode* dir_etc = create_dir( root, "etc" );
+    struct inode* dir_usr = create_dir( root, "usr" );
+    struct inode* kernel  = create_file( root, "kernel", 20000 );
+    create_file( dir_etc, "hosts", 200 );
+    save_inodes( mft_name, root );
+
+    set_journal_name( journal_name );
+    create_file( dir_etc, "passwd", 300 );
+    struct inode* dir_local = create_dir( dir_usr, "local" );
+    create_file( dir_local, "gcc", 12623 );
+    delete_file( root, kernel );
+    struct inode* dir_tmp = create_dir( root, "tmp" );
+    delete_dir( root, dir_tmp );
+    fs_shutdown( replay( "Replay over the older MFT:", mft_name, root ) );
+
+    /* The records of the journal are in the MFT now, too.
+     */
+    save_inodes( mft_name, root );
+    struct inode* before = replay( "Replay over an MFT with the changes:", mft_name, root );
+
+    /* Cut off the last record, as a crash while it was written would.
+     * Only the last change is lost.
+     */
+    create_file( root, "initrd", 3000 );
+    if( truncate( journal_name, file_size( journal_name ) - 3 ) != 0 )
+    {
+        printf("Failed to truncate %s\n", journal_name );
+    }
+    fs_shutdown( replay( "Replay with a cut off record, before it:", mft_name, before ) );
+    fs_shutdown( before );
+
+    checkpoint_inodes( mft_name, root );
+    printf("The journal has %ld bytes after the checkpoint\n", file_size( journal_name ) );
+    create_file( dir_etc, "motd", 100 );
+    fs_shutdown( replay( "Replay over the checkpoint:", mft_name, root ) );
+
+    set_journal_name( NULL );
+    fs_shutdown( root );
+    release_block_allocation_table_name( );
+}
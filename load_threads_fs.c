@@ -0,0 +1,116 @@
+#include "inode.h"
+#include "allocation.h"
+
+#include <stdio.h>
+
+#define NUM_DIRS      100
+#define FILES_PER_DIR 200
+
+/* Count the inodes that differ between two trees. Ids, names, sizes
+ * and blocks must all be the same.
+ */
+static int compare_trees( struct inode* a, struct inode* b )
+{
+    if( a == NULL || b == NULL ) return !( a == NULL && b == NULL );
+
+    if( a->id != b->id || strcmp( a->name, b->name ) != 0 ||
+        a->is_directory != b->is_directory )
+        return 1;
+
+    if( !a->is_directory )
+    {
+        if( a->filesize != b->filesize || a->num_blocks != b->num_blocks ) return 1;
+
+        struct block_iterator it_a;
+        struct block_iterator it_b;
+        size_t block_a;
+        size_t block_b;
+        block_iterator_init( &it_a, a );
+        block_iterator_init( &it_b, b );
+        while( block_iterator_next( &it_a, &block_a ) )
+        {
+            if( !block_iterator_next( &it_b, &block_b ) || block_a != block_b ) return 1;
+        }
+        return 0;
+    }
+
+    if( a->num_children != b->num_children ) return 1;
+
+    int differences = 0;
+    for( int i = 0; i < a->num_children; i++ )
+    {
+        differences += compare_trees( a->children[i], b->children[i] );
+    }
+    return differences;
+}
+
+static int count_inodes( struct inode* node )
+{
+    int count = 1;
+    if( node->is_directory )
+    {
+        for( int i = 0; i < node->num_children; i++ )
+        {
+            count += count_inodes( node->children[i] );
+        }
+    }
+    return count;
+}
+
+int main( int argc, char* argv[] )
+{
+    if( argc != 3 )
+    {
+        fprintf( stderr, "This program creates a file system with 20000 files, which is large enough\n"
+                         "for load_inodes() to use several threads, and saves it to the master file\n"
+                         "table (MFT). The MFT is loaded with 1, 2 and 4 threads, and every loaded\n"
+                         "tree is compared with the tree that was saved.\n"
+                         "\n"
+                         "Usage: %s MFT BAT\n"
+                         "       where\n"
+                         "       MFT is the name of the master file table\n"
+                         "       BAT is the name of the block allocation table\n"
+                         , argv[0] );
+        exit( -1 );
+    }
+
+    char* mft_name = argv[1];
+    char* bat_name = argv[2];
+    char  name[32];
+
+    set_block_allocation_table_name( bat_name );
+    /* Write the table once instead of once per file.
+     */
+    set_block_allocation_table_mode( BAT_MODE_CACHED );
+    set_disk_size( 32768 );
+    format_disk();
+
+    struct inode* root = create_dir( NULL, "/" );
+    for( int d = 0; d < NUM_DIRS; d++ )
+    {
+        snprintf( name, sizeof(name), "d%d", d );
+        struct inode* dir = create_dir( root, name );
+        for( int f = 0; f < FILES_PER_DIR; f++ )
+        {
+            snprintf( name, sizeof(name), "f%d", f );
+            create_file( dir, name, 100 + d * 10 + f );
+        }
+    }
+    save_inodes( mft_name, root );
+    printf("Saved %d inodes\n", count_inodes( root ) );
+
+    const int threads[] = { 1, 2, 4 };
+    for( int i = 0; i < 3; i++ )
+    {
+        set_load_threads( threads[i] );
+        struct inode* loaded = load_inodes( mft_name );
+        printf("Loaded with %d thread%s: %d inodes, %d differ\n",
+               threads[i], threads[i] == 1 ? " " : "s",
+               loaded ? count_inodes( loaded ) : 0, compare_trees( root, loaded ) );
+        if( loaded ) fs_shutdown( loaded );
+    }
+    set_load_threads( 1 );
+
+    fs_shutdown( root );
+    release_block_allocation_table_name( );
+}
@@ -0,0 +1,475 @@
+#include "inode.h"
+#include "mft_view.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Where the last child that was found below the directory at offset
+ * parent starts, so that the next child is found from there.
+ */
+struct mft_cursor
+{
+    long parent;
+    int  index;
+    long pos;
+};
+
+#define MFT_CURSORS 64
+
+/* The mapping of the file. As long as preorder is not 0, children are
+ * found by skipping over the records that save_inodes() wrote in
+ * pre-order, and cursors keep the place per directory. Once a child
+ * is not where pre-order puts it, a hash map from inode id to record
+ * is built instead. index_state is 0 before that, 1 when the map is
+ * ready, and -1 if the file turned out to be broken.
+ */
+struct mft_view
+{
+    const unsigned char*  data;
+    long                  size;
+    const unsigned char*  root;
+
+    int                   preorder;
+    struct mft_cursor     cursors[MFT_CURSORS];
+
+    int                   index_state;
+    int                   capacity;
+    const unsigned char** slots;
+};
+
+/* Values are stored in the byte order of the host, and records are
+ * not aligned.
+ */
+static int get_int( const unsigned char* p )
+{
+    int value;
+    memcpy( &value, p, sizeof(int) );
+    return value;
+}
+
+static size_t get_size( const unsigned char* p )
+{
+    size_t value;
+    memcpy( &value, p, sizeof(size_t) );
+    return value;
+}
+
+/* A record starts with the id and the length of the name including
+ * its terminating 0, followed by the name, the type byte and the
+ * payload of the type.
+ */
+static int name_length( const unsigned char* record )
+{
+    return get_int( record + sizeof(int) );
+}
+
+static char record_type( const unsigned char* record )
+{
+    return record[2 * sizeof(int) + name_length( record )];
+}
+
+static const unsigned char* payload( const unsigned char* record )
+{
+    return record + 2 * sizeof(int) + name_length( record ) + 1;
+}
+
+/* Return the number of bytes of the record at pos, or -1 if it is
+ * broken or does not fit. The name must be 0-terminated, because
+ * mft_node_name() returns it without a copy; only dead records have
+ * no name.
+ */
+static long record_size( const struct mft_view* view, long pos )
+{
+    const unsigned char* data = view->data;
+    long p = pos;
+
+    if( p + 2 * (long)sizeof(int) > view->size ) return -1;
+    int len = get_int( &data[p + sizeof(int)] );
+    p += 2 * sizeof(int);
+    if( len < 0 || p + len + 1 > view->size ) return -1;
+    p += len;
+
+    char type = data[p];
+    p += 1;
+    if( type != MFT_RECORD_DEAD && ( len == 0 || data[p - 2] != '\0' ) ) return -1;
+
+    long count_pos;
+    long header;
+    long entry;
+    switch( type )
+    {
+    case MFT_RECORD_DIRECTORY:
+        count_pos = p;
+        header    = sizeof(int);
+        entry     = sizeof(size_t);
+        break;
+    case MFT_RECORD_FILE:
+        count_pos = p + sizeof(int);
+        header    = 2 * sizeof(int);
+        entry     = sizeof(size_t);
+        break;
+    case MFT_RECORD_EXTENTS:
+        count_pos = p + 2 * sizeof(int);
+        header    = 3 * sizeof(int);
+        entry     = sizeof(size_t) + sizeof(int);
+        break;
+    case MFT_RECORD_DEAD:
+        count_pos = p;
+        header    = sizeof(int);
+        entry     = 1;
+        break;
+    default:
+        return -1;
+    }
+
+    if( p + header > view->size ) return -1;
+    int count = get_int( &data[count_pos] );
+    if( count < 0 || p + header + count * entry > view->size ) return -1;
+    p += header + count * entry;
+
+    return p - pos;
+}
+
+static int find_moved_root( struct mft_view* view );
+
+struct mft_view* mft_view_open( const char* master_file_table )
+{
+    int fd = open( master_file_table, O_RDONLY );
+    if( fd < 0 )
+    {
+        fprintf( stderr, "Failed to open file %s\n", master_file_table );
+        return NULL;
+    }
+
+    struct stat st;
+    if( fstat( fd, &st ) != 0 || st.st_size == 0 )
+    {
+        fprintf( stderr, "The master file table %s contains no inodes.\n", master_file_table );
+        close( fd );
+        return NULL;
+    }
+
+    void* addr = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    close( fd );
+    if( addr == MAP_FAILED )
+    {
+        fprintf( stderr, "Failed to map file %s\n", master_file_table );
+        perror("reason:");
+        return NULL;
+    }
+
+    struct mft_view* view = calloc( 1, sizeof(struct mft_view) );
+    if( view == NULL )
+    {
+        munmap( addr, st.st_size );
+        return NULL;
+    }
+    view->data = addr;
+    view->size = st.st_size;
+
+    if( record_size( view, 0 ) < 0 )
+    {
+        fprintf( stderr, "The master file table %s is broken at offset 0.\n", master_file_table );
+        mft_view_close( view );
+        return NULL;
+    }
+
+    /* The root is the first record, unless update_inodes() moved it and
+     * left a dead record there.
+     */
+    view->root = view->data;
+    if( record_type( view->root ) == MFT_RECORD_DEAD && find_moved_root( view ) != 0 )
+    {
+        fprintf( stderr, "The master file table %s has no root.\n", master_file_table );
+        mft_view_close( view );
+        return NULL;
+    }
+
+    view->preorder = ( view->root == view->data );
+    for( int c = 0; c < MFT_CURSORS; c++ )
+    {
+        view->cursors[c].parent = -1;
+    }
+    return view;
+}
+
+void mft_view_close( struct mft_view* view )
+{
+    if( view == NULL ) return;
+
+    munmap( (void*)view->data, view->size );
+    free( view->slots );
+    free( view );
+}
+
+static int index_slot( const struct mft_view* view, int id )
+{
+    int mask = view->capacity - 1;
+    int i    = ( (unsigned int)id * 2654435761u ) & mask;
+    while( view->slots[i] != NULL && get_int( view->slots[i] ) != id )
+        i = ( i + 1 ) & mask;
+    return i;
+}
+
+/* Map the id of every record to the record, in two passes over the
+ * length fields: one to count the records, one to fill the map. As in
+ * load_inodes(), a later record with the same id wins.
+ */
+static int build_index( struct mft_view* view )
+{
+    int count = 0;
+    for( long pos = 0; pos < view->size; )
+    {
+        long size = record_size( view, pos );
+        if( size < 0 )
+        {
+            fprintf( stderr, "The master file table is broken at offset %ld.\n", pos );
+            return -1;
+        }
+        count++;
+        pos += size;
+    }
+
+    view->capacity = 16;
+    while( view->capacity < count * 2 )
+        view->capacity *= 2;
+    view->slots = calloc( view->capacity, sizeof(const unsigned char*) );
+    if( view->slots == NULL ) return -1;
+
+    for( long pos = 0; pos < view->size; pos += record_size( view, pos ) )
+    {
+        const unsigned char* record = &view->data[pos];
+        if( record_type( record ) != MFT_RECORD_DEAD )
+            view->slots[index_slot( view, get_int( record ) )] = record;
+    }
+    return 0;
+}
+
+/* Find the root after it was moved: it is the first live record that
+ * no directory refers to. This needs the index, and a mark per slot.
+ */
+static int find_moved_root( struct mft_view* view )
+{
+    view->index_state = ( build_index( view ) == 0 ) ? 1 : -1;
+    if( view->index_state < 0 ) return -1;
+
+    char* referenced = calloc( view->capacity, 1 );
+    if( referenced == NULL ) return -1;
+
+    for( long pos = 0; pos < view->size; pos += record_size( view, pos ) )
+    {
+        const unsigned char* record = &view->data[pos];
+        if( record_type( record ) != MFT_RECORD_DIRECTORY ) continue;
+
+        const unsigned char* p     = payload( record );
+        int                  count = get_int( p );
+        for( int i = 0; i < count; i++ )
+            referenced[index_slot( view, (int)get_size( p + sizeof(int) + i * sizeof(size_t) ) )] = 1;
+    }
+
+    view->root = NULL;
+    for( long pos = 0; pos < view->size && view->root == NULL; pos += record_size( view, pos ) )
+    {
+        const unsigned char* record = &view->data[pos];
+        if( record_type( record ) != MFT_RECORD_DEAD && !referenced[index_slot( view, get_int( record ) )] )
+            view->root = record;
+    }
+    free( referenced );
+    return view->root ? 0 : -1;
+}
+
+static struct mft_node no_node( struct mft_view* view )
+{
+    struct mft_node node = { view, NULL };
+    return node;
+}
+
+struct mft_node mft_view_root( struct mft_view* view )
+{
+    struct mft_node node = { view, view->root };
+    return node;
+}
+
+int mft_node_id( struct mft_node node )
+{
+    return get_int( node.record );
+}
+
+const char* mft_node_name( struct mft_node node )
+{
+    return (const char*)node.record + 2 * sizeof(int);
+}
+
+int mft_node_is_directory( struct mft_node node )
+{
+    return record_type( node.record ) == MFT_RECORD_DIRECTORY;
+}
+
+int mft_node_num_children( struct mft_node node )
+{
+    if( !mft_node_is_directory( node ) ) return 0;
+    return get_int( payload( node.record ) );
+}
+
+/* Return the offset after the record at pos and the records of all
+ * its descendants, which follow it in pre-order, or -1 if one of them
+ * is broken or dead.
+ */
+static long skip_subtree( const struct mft_view* view, long pos )
+{
+    long pending = 1;
+    while( pending > 0 )
+    {
+        long size = record_size( view, pos );
+        if( size < 0 ) return -1;
+
+        const unsigned char* record = &view->data[pos];
+        if( record_type( record ) == MFT_RECORD_DEAD ) return -1;
+        if( record_type( record ) == MFT_RECORD_DIRECTORY ) pending += get_int( payload( record ) );
+        pending--;
+        pos += size;
+    }
+    return pos;
+}
+
+/* Find child i of the directory record parent where pre-order puts it:
+ * after the parent and the subtrees of the children before it. The
+ * search starts at the cursor of the parent if it is not past child i.
+ * Returns NULL if the record there is not the child with the given id.
+ */
+static const unsigned char* preorder_child( struct mft_view* view, const unsigned char* parent, int i, int id )
+{
+    long               parent_pos = parent - view->data;
+    struct mft_cursor* cursor     = &view->cursors[parent_pos % MFT_CURSORS];
+    int                index      = 0;
+    long               pos        = parent_pos + record_size( view, parent_pos );
+
+    if( cursor->parent == parent_pos && cursor->index <= i )
+    {
+        index = cursor->index;
+        pos   = cursor->pos;
+    }
+    for( ; index < i && pos > parent_pos; index++ )
+    {
+        pos = skip_subtree( view, pos );
+    }
+    if( pos <= parent_pos || record_size( view, pos ) < 0 ) return NULL;
+
+    const unsigned char* record = &view->data[pos];
+    if( record_type( record ) == MFT_RECORD_DEAD || get_int( record ) != id ) return NULL;
+
+    cursor->parent = parent_pos;
+    cursor->index  = i;
+    cursor->pos    = pos;
+    return record;
+}
+
+struct mft_node mft_node_child( struct mft_node node, int i )
+{
+    struct mft_view* view = node.view;
+    if( i < 0 || i >= mft_node_num_children( node ) ) return no_node( view );
+
+    size_t id = get_size( payload( node.record ) + sizeof(int) + i * sizeof(size_t) );
+    if( view->preorder )
+    {
+        struct mft_node child = { view, preorder_child( view, node.record, i, (int)id ) };
+        if( child.record != NULL ) return child;
+
+        /* update_inodes() moved or appended records.
+         */
+        view->preorder = 0;
+    }
+
+    if( view->index_state == 0 )
+    {
+        view->index_state = ( build_index( view ) == 0 ) ? 1 : -1;
+    }
+    if( view->index_state < 0 ) return no_node( view );
+
+    struct mft_node child = { view, view->slots[index_slot( view, (int)id )] };
+    return child;
+}
+
+/* Find the child whose name are the len bytes at name, which need not
+ * be 0-terminated.
+ */
+static struct mft_node find_child( struct mft_node node, const char* name, size_t len )
+{
+    int num_children = mft_node_num_children( node );
+    for( int i = 0; i < num_children; i++ )
+    {
+        struct mft_node child = mft_node_child( node, i );
+        if( child.record == NULL ) continue;
+
+        const char* child_name = mft_node_name( child );
+        if( (size_t)name_length( child.record ) == len + 1 && memcmp( child_name, name, len ) == 0 )
+            return child;
+    }
+    return no_node( node.view );
+}
+
+struct mft_node mft_node_find( struct mft_node node, const char* name )
+{
+    return find_child( node, name, strlen( name ) );
+}
+
+struct mft_node mft_view_lookup( struct mft_view* view, const char* path )
+{
+    struct mft_node node = mft_view_root( view );
+    const char*     p    = path;
+
+    while( node.record != NULL )
+    {
+        while( *p == '/' ) p++;
+        if( *p == '\0' ) break;
+
+        const char* end = p;
+        while( *end != '/' && *end != '\0' ) end++;
+
+        if( !mft_node_is_directory( node ) ) return no_node( view );
+
+        node = find_child( node, p, end - p );
+        p = end;
+    }
+    return node;
+}
+
+int mft_node_filesize( struct mft_node node )
+{
+    if( mft_node_is_directory( node ) ) return 0;
+    return get_int( payload( node.record ) );
+}
+
+int mft_node_num_blocks( struct mft_node node )
+{
+    if( mft_node_is_directory( node ) ) return 0;
+    return get_int( payload( node.record ) + sizeof(int) );
+}
+
+size_t mft_node_block( struct mft_node node, int i )
+{
+    if( i < 0 || i >= mft_node_num_blocks( node ) ) return MFT_NO_BLOCK;
+
+    const unsigned char* p = payload( node.record );
+    if( record_type( node.record ) == MFT_RECORD_FILE )
+    {
+        return get_size( p + 2 * sizeof(int) + i * sizeof(size_t) );
+    }
+
+    int num_extents = get_int( p + 2 * sizeof(int) );
+    p += 3 * sizeof(int);
+    for( int e = 0; e < num_extents; e++ )
+    {
+        size_t start  = get_size( p );
+        int    length = get_int( p + sizeof(size_t) );
+        if( i < length ) return start + i;
+        i -= length;
+        p += sizeof(size_t) + sizeof(int);
+    }
+    return MFT_NO_BLOCK;
+}
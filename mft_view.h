@@ -0,0 +1,89 @@
+#ifndef MFT_VIEW_H
+#define MFT_VIEW_H
+
+#include <stddef.h>
+
+/* A read-only view of a master file table that was written by
+ * save_inodes(). The file is mapped into memory, and nodes are
+ * handles that point straight into the mapping; no inodes are created
+ * and names are not copied. This suits tools that only look at a
+ * few paths of a large table.
+ *
+ *   struct mft_view* view = mft_view_open( "master_file_table" );
+ *   struct mft_node  node = mft_view_lookup( view, "/etc/hosts" );
+ *   if( node.record ) printf( "%s\n", mft_node_name( node ) );
+ *   mft_view_close( view );
+ *
+ * Handles stay valid until the view is closed. The file must not be
+ * changed while the view is open.
+ */
+struct mft_view;
+
+/* A node of a view. record points to the record of the node in the
+ * mapping, or is NULL if there is no such node.
+ */
+struct mft_node
+{
+    struct mft_view*     view;
+    const unsigned char* record;
+};
+
+/* Map the file master_file_table. Only the first record, the root,
+ * is checked, unless update_inodes() moved the root. Returns NULL if
+ * the file cannot be mapped or does not start with a valid record.
+ */
+struct mft_view* mft_view_open( const char* master_file_table );
+
+/* Remove the mapping and release the view.
+ */
+void mft_view_close( struct mft_view* view );
+
+/* Return the root node, which is the first record of the file, or
+ * the record that no directory refers to if update_inodes() moved it.
+ */
+struct mft_node mft_view_root( struct mft_view* view );
+
+/* Follow the path from the root like lookup_path() does and return
+ * the node it names, or a node with record NULL.
+ */
+struct mft_node mft_view_lookup( struct mft_view* view, const char* path );
+
+int         mft_node_id( struct mft_node node );
+const char* mft_node_name( struct mft_node node );
+int         mft_node_is_directory( struct mft_node node );
+
+/* The number of children of a directory, 0 for a file.
+ */
+int mft_node_num_children( struct mft_node node );
+
+/* Return child i of a directory. In a file that save_inodes() wrote,
+ * the child is found by skipping the subtrees of the children before
+ * it, starting from the last child found in the same directory. Once
+ * a child is missing from its place, because update_inodes() moved or
+ * appended records, the record lengths of the whole file are scanned
+ * once to map ids to records. The node has record NULL if the child
+ * is not in the file, or if the file is broken.
+ */
+struct mft_node mft_node_child( struct mft_node node, int i );
+
+/* Return the child of a directory with the given name, or a node
+ * with record NULL.
+ */
+struct mft_node mft_node_find( struct mft_node node, const char* name );
+
+/* The size in bytes and the number of blocks of a file, 0 for a
+ * directory.
+ */
+int mft_node_filesize( struct mft_node node );
+int mft_node_num_blocks( struct mft_node node );
+
+/* Return block i of a file. This takes constant time for a file that
+ * is stored as a block list, and time linear in the number of extents
+ * for a file that is stored as extents. Returns MFT_NO_BLOCK if i is
+ * not between 0 and mft_node_num_blocks() - 1.
+ */
+#define MFT_NO_BLOCK ( (size_t)-1 )
+
+size_t mft_node_block( struct mft_node node, int i );
+
+#endif // MFT_VIEW_H
@@ -0,0 +1,172 @@
+#include "inode.h"
+#include "allocation.h"
+#include "mft_view.h"
+
+#include <stdio.h>
+
+static const char* paths[] =
+{
+    "/",
+    "/kernel",
+    "/etc",
+    "/etc/hosts",
+    "/etc/host.conf",
+    "/usr/bin/ls",
+    "/usr/lib/libc.so",
+    "/usr/local/bin/gcc",
+    "/usr/local/bin/clang",
+    "/usr/bin/ls/x",
+    "/initrd",
+    "/home",
+    NULL
+};
+
+/* Compare the node of the view with the inode that lookup_path()
+ * found. Both may be missing.
+ */
+static int same_node( struct mft_node view_node, struct inode* node )
+{
+    if( view_node.record == NULL || node == NULL )
+        return view_node.record == NULL && node == NULL;
+
+    if( mft_node_id( view_node ) != node->id ) return 0;
+    if( strcmp( mft_node_name( view_node ), node->name ) != 0 ) return 0;
+    if( mft_node_is_directory( view_node ) != node->is_directory ) return 0;
+    if( mft_node_num_children( view_node ) != node->num_children ) return 0;
+    if( mft_node_filesize( view_node ) != node->filesize ) return 0;
+    if( mft_node_num_blocks( view_node ) != node->num_blocks ) return 0;
+
+    struct block_iterator it;
+    size_t block;
+    int    i = 0;
+    block_iterator_init( &it, node );
+    while( block_iterator_next( &it, &block ) )
+    {
+        if( mft_node_block( view_node, i++ ) != block ) return 0;
+    }
+    return 1;
+}
+
+/* Walk the view and the loaded tree side by side and count the nodes
+ * that differ.
+ */
+static int compare_walk( struct mft_node view_node, struct inode* node )
+{
+    if( !same_node( view_node, node ) ) return 1;
+
+    int differences = 0;
+    for( int i = 0; i < node->num_children; i++ )
+    {
+        differences += compare_walk( mft_node_child( view_node, i ), node->children[i] );
+    }
+    return differences;
+}
+
+/* Look up every path in a view of the file and in the tree that
+ * load_inodes() creates from it.
+ */
+static void compare( char* mft_name )
+{
+    struct inode*    root = load_inodes( mft_name );
+    struct mft_view* view = mft_view_open( mft_name );
+    if( root == NULL || view == NULL )
+    {
+        printf("Failed to load %s\n", mft_name );
+        if( root ) fs_shutdown( root );
+        if( view ) mft_view_close( view );
+        return;
+    }
+
+    for( int i = 0; paths[i]; i++ )
+    {
+        struct mft_node view_node = mft_view_lookup( view, paths[i] );
+        struct inode*   node      = lookup_path( root, paths[i] );
+        printf("%-22s %-9s %s\n", paths[i],
+               view_node.record ? "found" : "not found",
+               same_node( view_node, node ) ? "same as lookup_path" : "DIFFERENT from lookup_path" );
+    }
+    printf("Nodes that differ in a walk of the whole tree: %d\n",
+           compare_walk( mft_view_root( view ), root ) );
+
+    /* Block numbers outside a file, of a block list, of extents and of
+     * a directory.
+     */
+    struct mft_node ls   = mft_view_lookup( view, "/usr/bin/ls" );
+    struct mft_node libc = mft_view_lookup( view, "/usr/lib/libc.so" );
+    struct mft_node etc  = mft_view_lookup( view, "/etc" );
+    int outside = mft_node_block( ls, -1 ) == MFT_NO_BLOCK
+               && mft_node_block( ls, mft_node_num_blocks( ls ) ) == MFT_NO_BLOCK
+               && mft_node_block( libc, -1 ) == MFT_NO_BLOCK
+               && mft_node_block( libc, mft_node_num_blocks( libc ) ) == MFT_NO_BLOCK
+               && mft_node_block( etc, 0 ) == MFT_NO_BLOCK;
+    printf("Blocks outside the files: %s\n", outside ? "MFT_NO_BLOCK" : "WRONG block numbers" );
+
+    mft_view_close( view );
+    fs_shutdown( root );
+}
+
+int main( int argc, char* argv[] )
+{
+    if( argc != 3 )
+    {
+        fprintf( stderr, "This program creates a small file system, saves it to the master file table (MFT)\n"
+                         "and opens the MFT as a read-only view. Every path that it looks up in the view\n"
+                         "is also looked up in the inodes that load_inodes() creates, and the results\n"
+                         "are compared. This is repeated after update_inodes() moved a directory,\n"
+                         "and after it moved the root.\n"
+                         "\n"
+                         "Usage: %s MFT BAT\n"
+                         "       where\n"
+                         "       MFT is the name of the master file table\n"
+                         "       BAT is the name of the block allocation table\n"
+                         , argv[0] );
+        exit( -1 );
+    }
+
+    char* mft_name = argv[1];
+    char* bat_name = argv[2];
+
+    set_block_allocation_table_name( bat_name );
+    format_disk();
+
+    struct inode* root      = create_dir( NULL, "/" );
+    struct inode* dir_etc   = create_dir( root, "etc" );
+    struct inode* dir_usr   = create_dir( root, "usr" );
+    struct inode* dir_bin   = create_dir( dir_usr, "bin" );
+    struct inode* dir_lib   = create_dir( dir_usr, "lib" );
+    struct inode* dir_local = create_dir( dir_usr, "local" );
+    struct inode* dir_lbin  = create_dir( dir_local, "bin" );
+    create_file( root, "kernel", 20000 );
+    create_file( dir_etc, "hosts", 200 );
+    create_file( dir_bin, "ls", 14322 );
+    create_file( dir_lbin, "gcc", 12623 );
+
+    /* The view reads block lists and extents.
+     */
+    set_file_layout( FILE_LAYOUT_EXTENTS );
+    create_file( dir_lib, "libc.so", 30000 );
+    set_file_layout( FILE_LAYOUT_BLOCKS );
+
+    save_inodes( mft_name, root );
+    compare( mft_name );
+
+    /* /etc outgrows its record and moves to the end of the file, but
+     * the root stays in place.
+     */
+    create_file( dir_etc, "motd", 100 );
+    update_inodes( mft_name, root );
+    printf("After update_inodes() moved /etc:\n");
+    compare( mft_name );
+
+    /* The root gets more children than its record has room for, so
+     * update_inodes() moves it to the end of the file.
+     */
+    create_file( root, "initrd", 3000 );
+    create_dir( root, "home" );
+    update_inodes( mft_name, root );
+    fs_shutdown( root );
+    printf("After update_inodes() moved the root:\n");
+    compare( mft_name );
+
+    release_block_allocation_table_name( );
+}
@@ -0,0 +1,304 @@
+#include "inode.h"
+#include "stat_tree.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+
+/* A task is the range [lo,hi) of the children of dir, whose totals are
+ * added to stats[target]. Ranges longer than STAT_TASK_CHILDREN are
+ * split in halves, so that one wide directory is shared by threads.
+ */
+#define STAT_TASK_CHILDREN 1024
+
+struct stat_task
+{
+    struct inode* dir;
+    int           lo;
+    int           hi;
+    int           target;
+};
+
+/* The owner pushes and pops tasks at the tail, thieves take them from
+ * the head. The array is compacted or grown when the tail reaches its
+ * end.
+ */
+struct stat_deque
+{
+    pthread_mutex_t   lock;
+    struct stat_task* tasks;
+    int               capacity;
+    int               head;
+    int               tail;
+};
+
+struct stat_pool;
+
+struct stat_worker
+{
+    struct stat_deque deque;
+    struct tree_stat* stats;
+    struct stat_pool* pool;
+    int               index;
+    pthread_t         thread;
+};
+
+/* pending counts the tasks that were pushed but not finished yet. The
+ * walk is over when it drops to 0.
+ */
+struct stat_pool
+{
+    struct stat_worker* workers;
+    int                 num_workers;
+    atomic_long         pending;
+    atomic_int          failed;
+};
+
+static int stat_push( struct stat_worker* worker, struct stat_task task )
+{
+    struct stat_deque* deque = &worker->deque;
+    int ok = 1;
+
+    pthread_mutex_lock( &deque->lock );
+    if( deque->tail == deque->capacity )
+    {
+        if( deque->head > deque->capacity / 2 )
+        {
+            memmove( deque->tasks, &deque->tasks[deque->head],
+                     ( deque->tail - deque->head ) * sizeof(struct stat_task) );
+            deque->tail -= deque->head;
+            deque->head  = 0;
+        }
+        else
+        {
+            int capacity = deque->capacity ? 2 * deque->capacity : 64;
+            struct stat_task* tasks = realloc( deque->tasks, capacity * sizeof(struct stat_task) );
+            if( tasks == NULL )
+            {
+                ok = 0;
+            }
+            else
+            {
+                deque->tasks    = tasks;
+                deque->capacity = capacity;
+            }
+        }
+    }
+    if( ok )
+    {
+        /* Count the task before a thief can finish it */
+        atomic_fetch_add( &worker->pool->pending, 1 );
+        deque->tasks[deque->tail++] = task;
+    }
+    pthread_mutex_unlock( &deque->lock );
+
+    if( !ok )
+    {
+        fprintf( stderr, "fs_stat_tree: out of memory\n" );
+        atomic_store( &worker->pool->failed, 1 );
+        return -1;
+    }
+    return 0;
+}
+
+static int stat_pop( struct stat_worker* worker, struct stat_task* task )
+{
+    struct stat_deque* deque = &worker->deque;
+    int found = 0;
+
+    pthread_mutex_lock( &deque->lock );
+    if( deque->tail > deque->head )
+    {
+        *task = deque->tasks[--deque->tail];
+        found = 1;
+    }
+    if( deque->tail == deque->head )
+    {
+        deque->head = deque->tail = 0;
+    }
+    pthread_mutex_unlock( &deque->lock );
+    return found;
+}
+
+static int stat_steal( struct stat_worker* worker, struct stat_task* task )
+{
+    struct stat_pool* pool = worker->pool;
+
+    for( int k = 1; k < pool->num_workers; k++ )
+    {
+        struct stat_deque* deque = &pool->workers[( worker->index + k ) % pool->num_workers].deque;
+        int found = 0;
+
+        pthread_mutex_lock( &deque->lock );
+        if( deque->tail > deque->head )
+        {
+            *task = deque->tasks[deque->head++];
+            found = 1;
+        }
+        pthread_mutex_unlock( &deque->lock );
+
+        if( found ) return 1;
+    }
+    return 0;
+}
+
+/* Add up the files of a task and push its subdirectories as new tasks.
+ */
+static void stat_run( struct stat_worker* worker, struct stat_task task )
+{
+    struct tree_stat* stat = &worker->stats[task.target];
+
+    while( task.hi - task.lo > STAT_TASK_CHILDREN )
+    {
+        struct stat_task upper = task;
+        upper.lo = task.lo + ( task.hi - task.lo ) / 2;
+        task.hi  = upper.lo;
+        if( stat_push( worker, upper ) != 0 ) return;
+    }
+
+    for( int i = task.lo; i < task.hi; i++ )
+    {
+        struct inode* child = task.dir->children[i];
+        if( child->is_directory )
+        {
+            stat->num_dirs++;
+            if( child->num_children > 0 )
+            {
+                struct stat_task sub = { child, 0, child->num_children, task.target };
+                if( stat_push( worker, sub ) != 0 ) return;
+            }
+        }
+        else
+        {
+            stat->num_files++;
+            stat->bytes  += child->filesize;
+            stat->blocks += child->num_blocks;
+        }
+    }
+}
+
+static void* stat_work( void* arg )
+{
+    struct stat_worker* worker = arg;
+    struct stat_pool*   pool   = worker->pool;
+    struct stat_task    task;
+
+    for( ;; )
+    {
+        if( stat_pop( worker, &task ) || stat_steal( worker, &task ) )
+        {
+            if( !atomic_load( &pool->failed ) )
+            {
+                stat_run( worker, task );
+            }
+            atomic_fetch_sub( &pool->pending, 1 );
+        }
+        else if( atomic_load( &pool->pending ) == 0 )
+        {
+            break;
+        }
+        else
+        {
+            sched_yield( );
+        }
+    }
+    return NULL;
+}
+
+int fs_stat_tree( struct inode** dirs, int num_dirs, struct tree_stat* stats, int threads )
+{
+    if( dirs == NULL || stats == NULL || num_dirs < 0 )
+    {
+        fprintf( stderr, "fs_stat_tree: invalid arguments\n" );
+        return -1;
+    }
+    if( threads < 1 ) threads = 1;
+
+    struct stat_pool pool;
+    pool.workers     = calloc( threads, sizeof(struct stat_worker) );
+    pool.num_workers = threads;
+    atomic_init( &pool.pending, 0 );
+    atomic_init( &pool.failed, 0 );
+    if( pool.workers == NULL )
+    {
+        fprintf( stderr, "fs_stat_tree: out of memory\n" );
+        return -1;
+    }
+
+    int ready = 0;
+    for( ; ready < threads; ready++ )
+    {
+        struct stat_worker* worker = &pool.workers[ready];
+        worker->stats = calloc( num_dirs ? num_dirs : 1, sizeof(struct tree_stat) );
+        if( worker->stats == NULL ) break;
+        pthread_mutex_init( &worker->deque.lock, NULL );
+        worker->pool  = &pool;
+        worker->index = ready;
+    }
+
+    int result = 0;
+    if( ready < threads )
+    {
+        fprintf( stderr, "fs_stat_tree: out of memory\n" );
+        result = -1;
+    }
+    else
+    {
+        memset( stats, 0, num_dirs * sizeof(struct tree_stat) );
+
+        /* Deal the requested directories out to the threads */
+        for( int i = 0; i < num_dirs; i++ )
+        {
+            struct inode* dir = dirs[i];
+            if( dir == NULL ) continue;
+            if( !dir->is_directory )
+            {
+                stats[i].num_files = 1;
+                stats[i].bytes     = dir->filesize;
+                stats[i].blocks    = dir->num_blocks;
+                continue;
+            }
+            struct stat_task task = { dir, 0, dir->num_children, i };
+            if( dir->num_children > 0 )
+                stat_push( &pool.workers[i % threads], task );
+        }
+
+        int started[threads];
+        for( int t = 1; t < threads; t++ )
+        {
+            started[t] = ( pthread_create( &pool.workers[t].thread, NULL, stat_work, &pool.workers[t] ) == 0 );
+        }
+        stat_work( &pool.workers[0] );
+        for( int t = 1; t < threads; t++ )
+        {
+            if( started[t] ) pthread_join( pool.workers[t].thread, NULL );
+        }
+
+        if( atomic_load( &pool.failed ) )
+        {
+            result = -1;
+        }
+        for( int t = 0; t < threads; t++ )
+        {
+            for( int i = 0; i < num_dirs; i++ )
+            {
+                stats[i].num_files += pool.workers[t].stats[i].num_files;
+                stats[i].num_dirs  += pool.workers[t].stats[i].num_dirs;
+                stats[i].bytes     += pool.workers[t].stats[i].bytes;
+                stats[i].blocks    += pool.workers[t].stats[i].blocks;
+            }
+        }
+    }
+
+    for( int t = 0; t < ready; t++ )
+    {
+        pthread_mutex_destroy( &pool.workers[t].deque.lock );
+        free( pool.workers[t].deque.tasks );
+        free( pool.workers[t].stats );
+    }
+    free( pool.workers );
+    return result;
+}
@@ -0,0 +1,32 @@
+#ifndef STAT_TREE_H
+#define STAT_TREE_H
+
+#include "inode.h"
+
+/* Totals over the subtree below a directory. The directory itself is
+ * not counted. blocks is the sum of num_blocks of all files, whether
+ * they keep blocks or extents.
+ */
+struct tree_stat
+{
+    long num_files;
+    long num_dirs;
+    long bytes;
+    long blocks;
+};
+
+/* Add up the files, directories, bytes and blocks below each of the
+ * num_dirs inodes in dirs and store the totals in stats[i]. If dirs[i]
+ * is a file, stats[i] counts only that file. Subtrees may overlap.
+ *
+ * The walk runs on threads threads. Each one keeps a queue of
+ * directories, and large directories are split into ranges of
+ * children. A thread whose queue runs empty steals the oldest entry,
+ * usually the largest subtree, from another thread.
+ *
+ * The tree must not change during the call.
+ * Returns 0 in case of success and -1 in case of an error.
+ */
+int fs_stat_tree( struct inode** dirs, int num_dirs, struct tree_stat* stats, int threads );
+
+#endif
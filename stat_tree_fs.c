@@ -0,0 +1,186 @@
+#include "inode.h"
+#include "allocation.h"
+#include "stat_tree.h"
+
+#include <stdio.h>
+
+static const char* paths[] =
+{
+    "/",
+    "/wide",
+    "/d3",
+    "/d3/s1",
+    "/d0/f0",
+    "/d7/s2/f4",
+    NULL
+};
+
+#define NUM_PATHS ( sizeof(paths) / sizeof(paths[0]) - 1 )
+
+/* Add up the subtree below node the simple way, on one thread and
+ * without fs_stat_tree().
+ */
+static void serial_walk( struct inode* node, struct tree_stat* stat )
+{
+    for( int i = 0; i < node->num_children; i++ )
+    {
+        struct inode* child = node->children[i];
+        if( child->is_directory )
+        {
+            stat->num_dirs++;
+            serial_walk( child, stat );
+        }
+        else
+        {
+            stat->num_files++;
+            stat->bytes  += child->filesize;
+            stat->blocks += child->num_blocks;
+        }
+    }
+}
+
+static void serial_stat( struct inode* node, struct tree_stat* stat )
+{
+    memset( stat, 0, sizeof(struct tree_stat) );
+    if( node->is_directory )
+    {
+        serial_walk( node, stat );
+    }
+    else
+    {
+        stat->num_files = 1;
+        stat->bytes     = node->filesize;
+        stat->blocks    = node->num_blocks;
+    }
+}
+
+static int same_stat( struct tree_stat* a, struct tree_stat* b )
+{
+    return a->num_files == b->num_files
+        && a->num_dirs  == b->num_dirs
+        && a->bytes     == b->bytes
+        && a->blocks    == b->blocks;
+}
+
+/* Run fs_stat_tree() on the paths below root with the given number of
+ * threads and compare each result with expected.
+ */
+static void compare( const char* what, struct inode* root, struct tree_stat* expected, int threads )
+{
+    struct inode*    dirs[NUM_PATHS];
+    struct tree_stat stats[NUM_PATHS];
+
+    for( size_t i = 0; i < NUM_PATHS; i++ )
+    {
+        dirs[i] = lookup_path( root, paths[i] );
+    }
+
+    if( fs_stat_tree( dirs, NUM_PATHS, stats, threads ) != 0 )
+    {
+        printf("fs_stat_tree failed on the %s tree with %d threads\n", what, threads );
+        return;
+    }
+
+    int differences = 0;
+    for( size_t i = 0; i < NUM_PATHS; i++ )
+    {
+        if( !same_stat( &stats[i], &expected[i] ) )
+        {
+            printf("%-10s %-12s DIFFERENT from the serial walk\n", what, paths[i] );
+            differences++;
+        }
+    }
+    printf("%-7s tree, %d thread%s: %d of %d paths differ from the serial walk\n",
+           what, threads, threads == 1 ? " " : "s", differences, (int)NUM_PATHS );
+}
+
+int main( int argc, char* argv[] )
+{
+    if( argc != 3 )
+    {
+        fprintf( stderr, "This program creates a file system with a few thousand files, saves it to\n"
+                         "the master file table (MFT) and loads it again. fs_stat_tree() adds up\n"
+                         "several subtrees of both trees, on one thread and on several, and the totals\n"
+                         "are compared with a serial walk.\n"
+                         "\n"
+                         "Usage: %s MFT BAT\n"
+                         "       where\n"
+                         "       MFT is the name of the master file table\n"
+                         "       BAT is the name of the block allocation table\n"
+                         , argv[0] );
+        exit( -1 );
+    }
+
+    char* mft_name = argv[1];
+    char* bat_name = argv[2];
+    char  name[32];
+
+    set_block_allocation_table_name( bat_name );
+    set_disk_size( 8192 );
+    format_disk();
+
+    /* Eight directories with three levels below them, and one directory
+     * that is wide enough for fs_stat_tree() to split its children.
+     */
+    struct inode* root = create_dir( NULL, "/" );
+    int size = 0;
+    for( int d = 0; d < 8; d++ )
+    {
+        snprintf( name, sizeof(name), "d%d", d );
+        struct inode* dir = create_dir( root, name );
+        for( int f = 0; f < 10; f++ )
+        {
+            snprintf( name, sizeof(name), "f%d", f );
+            create_file( dir, name, size );
+            size = ( size + 1237 ) % 9000;
+        }
+        for( int s = 0; s < 4; s++ )
+        {
+            snprintf( name, sizeof(name), "s%d", s );
+            struct inode* sub = create_dir( dir, name );
+            for( int f = 0; f < 20; f++ )
+            {
+                snprintf( name, sizeof(name), "f%d", f );
+                create_file( sub, name, size );
+                size = ( size + 1237 ) % 9000;
+            }
+            create_dir( sub, "empty" );
+        }
+    }
+    struct inode* wide = create_dir( root, "wide" );
+    for( int f = 0; f < 3000; f++ )
+    {
+        snprintf( name, sizeof(name), "w%d", f );
+        create_file( wide, name, f % 100 );
+    }
+    save_inodes( mft_name, root );
+
+    struct tree_stat expected[NUM_PATHS];
+    for( size_t i = 0; i < NUM_PATHS; i++ )
+    {
+        serial_stat( lookup_path( root, paths[i] ), &expected[i] );
+        printf("%-12s files %5ld  dirs %3ld  bytes %9ld  blocks %5ld\n", paths[i],
+               expected[i].num_files, expected[i].num_dirs,
+               expected[i].bytes, expected[i].blocks );
+    }
+
+    struct inode* loaded = load_inodes( mft_name );
+    if( loaded == NULL )
+    {
+        printf("Failed to load %s\n", mft_name );
+        fs_shutdown( root );
+        release_block_allocation_table_name( );
+        return -1;
+    }
+
+    int threads[] = { 1, 4 };
+    for( int t = 0; t < 2; t++ )
+    {
+        compare( "created", root,   expected, threads[t] );
+        compare( "loaded",  loaded, expected, threads[t] );
+    }
+
+    fs_shutdown( loaded );
+    fs_shutdown( root );
+    release_block_allocation_table_name( );
+}
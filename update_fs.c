@@ -0,0 +1,131 @@
+#include "inode.h"
+#include "allocation.h"
+
+#include <stdio.h>
+#include <sys/stat.h>
+
+/* Count the inodes that differ between two trees. Ids, names, sizes
+ * and blocks must all be the same.
+ */
+static int compare_trees( struct inode* a, struct inode* b )
+{
+    if( a == NULL || b == NULL ) return !( a == NULL && b == NULL );
+
+    if( a->id != b->id || strcmp( a->name, b->name ) != 0 ||
+        a->is_directory != b->is_directory )
+        return 1;
+
+    if( !a->is_directory )
+    {
+        if( a->filesize != b->filesize || a->num_blocks != b->num_blocks ) return 1;
+
+        struct block_iterator it_a;
+        struct block_iterator it_b;
+        size_t block_a;
+        size_t block_b;
+        block_iterator_init( &it_a, a );
+        block_iterator_init( &it_b, b );
+        while( block_iterator_next( &it_a, &block_a ) )
+        {
+            if( !block_iterator_next( &it_b, &block_b ) || block_a != block_b ) return 1;
+        }
+        return 0;
+    }
+
+    if( a->num_children != b->num_children ) return 1;
+
+    int differences = 0;
+    for( int i = 0; i < a->num_children; i++ )
+    {
+        differences += compare_trees( a->children[i], b->children[i] );
+    }
+    return differences;
+}
+
+/* Print the size of the MFT and the id of its first record, which is
+ * -1 once update_inodes() has moved the root and left a dead record
+ * in its place.
+ */
+static void print_mft( const char* what, char* mft_name )
+{
+    struct stat st;
+    int         id   = -2;
+    FILE*       file = fopen( mft_name, "rb" );
+    if( file )
+    {
+        if( fread( &id, sizeof(int), 1, file ) != 1 ) id = -2;
+        fclose( file );
+    }
+    if( stat( mft_name, &st ) != 0 ) st.st_size = -1;
+    printf("%-28s %ld bytes, first record id %d\n", what, (long)st.st_size, id );
+}
+
+/* Load the MFT and compare the loaded tree with expected.
+ */
+static struct inode* reload( char* mft_name, struct inode* expected )
+{
+    struct inode* loaded = load_inodes( mft_name );
+    printf("%-28s %d inodes differ\n", "Loaded again:", compare_trees( expected, loaded ) );
+    return loaded;
+}
+
+int main( int argc, char* argv[] )
+{
+    if( argc != 3 )
+    {
+        fprintf( stderr, "This program creates a small file system and saves it to the master file\n"
+                         "table (MFT). It changes the tree so that the root grows out of its record,\n"
+                         "writes only the changes with update_inodes() and loads the MFT again. The\n"
+                         "loaded tree is changed and updated once more, and finally save_inodes()\n"
+                         "rewrites the MFT without dead records.\n"
+                         "\n"
+                         "Usage: %s MFT BAT\n"
+                         "       where\n"
+                         "       MFT is the name of the master file table\n"
+                         "       BAT is the name of the block allocation table\n"
+                         , argv[0] );
+        exit( -1 );
+    }
+
+    char* mft_name = argv[1];
+    char* bat_name = argv[2];
+
+    set_block_allocation_table_name( bat_name );
+    format_disk();
+
+    struct inode* root    = create_dir( NULL, "/" );
+    struct inode* dir_etc = create_dir( root, "etc" );
+    struct inode* dir_usr = create_dir( root, "usr" );
+    struct inode* dir_bin = create_dir( dir_usr, "bin" );
+    struct inode* kernel  = create_file( root, "kernel", 20000 );
+    create_file( dir_etc, "hosts", 200 );
+    create_file( dir_bin, "ls", 14322 );
+    save_inodes( mft_name, root );
+    print_mft( "Saved:", mft_name );
+
+    delete_file( root, kernel );
+    create_file( root, "initrd", 3000 );
+    create_dir( root, "home" );
+    create_dir( root, "tmp" );
+    create_file( dir_etc, "passwd", 300 );
+    update_inodes( mft_name, root );
+    print_mft( "Updated, the root moved:", mft_name );
+    struct inode* loaded = reload( mft_name, root );
+    fs_shutdown( root );
+
+    /* load_inodes() remembered the MFT, so the loaded tree can be
+     * updated in turn.
+     */
+    create_file( lookup_path( loaded, "/home" ), "notes", 5000 );
+    delete_file( lookup_path( loaded, "/etc" ), lookup_path( loaded, "/etc/hosts" ) );
+    update_inodes( mft_name, loaded );
+    print_mft( "Updated the loaded tree:", mft_name );
+    fs_shutdown( reload( mft_name, loaded ) );
+
+    save_inodes( mft_name, loaded );
+    print_mft( "Saved without dead records:", mft_name );
+    fs_shutdown( reload( mft_name, loaded ) );
+
+    fs_shutdown( loaded );
+    release_block_allocation_table_name( );
+}